@@ -23,9 +23,69 @@
 #ifndef JW_MATH_HPP_
 #define JW_MATH_HPP_
 
+#include <cfloat>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifndef JW_MATH_NO_THREADS
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#endif
+
+#if !defined(JW_MATH_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define JW_MATH_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Kernels for wider instruction sets are compiled per-function so that a
+// single binary can pick the best one at runtime instead of requiring -mavx.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define JW_MATH_TARGET(isa)
+#else
+#define JW_MATH_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// SSE2 usable without a target attribute, i.e. part of the compiler baseline
+#if defined(JW_MATH_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define JW_MATH_SSE2
+#endif
+
+// Opt-in: keep vec4 and quat in XMM registers. Requires SSE2 in the compiler
+// baseline, and the anonymous struct used for .x/.y/.z/.w is an extension
+// supported by GCC, Clang and MSVC; it is marked as such (__extension__, or
+// disabling C4201 on MSVC) so pedantic builds stay warning-free.
+#ifdef JW_MATH_SIMD
+#ifndef JW_MATH_SSE2
+#error "JW_MATH_SIMD requires an x86 target with SSE2 enabled"
+#endif
+#define JW_MATH_ALIGN16 alignas(16)
+#if defined(_MSC_VER) && !defined(__clang__)
+#define JW_MATH_EXTENSION
+#else
+#define JW_MATH_EXTENSION __extension__
+#endif
+#else
+#define JW_MATH_ALIGN16
+#endif
+
+// Debug checks on caller preconditions, compiled out with NDEBUG unless
+// JW_MATH_ASSERT is defined beforehand.
+#ifndef JW_MATH_ASSERT
+#include <cassert>
+#define JW_MATH_ASSERT(x) assert(x)
+#endif
 
 namespace jw
 {
@@ -48,531 +108,5156 @@ namespace jw
     return degrees * DEGREES_TO_RADIANS;
   }
 
-  struct vec2
+  // Instruction set levels, each implying the ones before it. avx2 includes FMA.
+  enum class isa
   {
-    f32 x, y;
-    vec2(f32 s) : x(s), y(s) {}
-    vec2(f32 x, f32 y) : x(x), y(y) {}
+    scalar,
+    sse2,
+    sse41,
+    avx,
+    avx2,
+    avx512
+  };
 
-    void print(bool print_type = true, FILE* output = stdout) const
+  inline const char *isa_name(isa level)
+  {
+    switch (level)
     {
-      if (print_type)
-        fprintf(output, "vec2\n");
-      fprintf(output, "--          --\n| %.4e |\n| %.4e |\n--          --\n", x, y);
+    case isa::sse2:
+      return "sse2";
+    case isa::sse41:
+      return "sse41";
+    case isa::avx:
+      return "avx";
+    case isa::avx2:
+      return "avx2";
+    case isa::avx512:
+      return "avx512";
+    default:
+      return "scalar";
     }
+  }
 
-    f32 dot(const vec2 &b) const
+  // Execution policy for batch operations: seq runs on the calling thread and par
+  // spreads the batch over a shared pool of hardware_concurrency() threads. Set
+  // threads to cap the number used (0 means all). Results are identical for every
+  // thread count. Defining JW_MATH_NO_THREADS makes every policy sequential.
+  //
+  // streaming() asks for non-temporal stores, which bypass the cache, for outputs of
+  // at least stream_threshold() bytes that are 16-byte aligned. Use it for outputs
+  // that will not be read back soon, such as a large vertex buffer headed for upload.
+  struct execution_policy
+  {
+    u32 threads;
+    bool stream;
+
+    execution_policy streaming() const
     {
-      return x * b.x + y * b.y;
+      return {threads, true};
     }
+  };
 
-    f32 length_squared() const
+  const execution_policy seq = {1, false};
+  const execution_policy par = {0, false};
+
+  namespace detail
+  {
+    struct cpu_features
     {
-      return dot(*this);
+      bool sse2 = false, sse41 = false, avx = false, fma = false, avx2 = false, avx512f = false;
+    };
+
+#ifdef JW_MATH_X86
+    inline void cpuid(u32 leaf, u32 subleaf, u32 regs[4])
+    {
+#if defined(_MSC_VER)
+      int r[4];
+      __cpuidex(r, (int)leaf, (int)subleaf);
+      for (int i = 0; i < 4; i++)
+        regs[i] = (u32)r[i];
+#else
+      __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
     }
 
-    f32 length() const
+    inline u64 xgetbv(u32 index)
     {
-      return sqrtf(length_squared());
+#if defined(_MSC_VER)
+      return _xgetbv(index);
+#else
+      u32 eax, edx;
+      __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+      return ((u64)edx << 32) | eax;
+#endif
     }
+#endif
 
-    vec2 &normalize()
+    inline cpu_features query_cpu_features()
     {
-      f32 l = length();
-      x /= l;
-      y /= l;
-      return *this;
+      cpu_features f;
+#ifdef JW_MATH_X86
+      u32 r[4];
+      cpuid(0, 0, r);
+      u32 max_leaf = r[0];
+
+      cpuid(1, 0, r);
+      f.sse2 = r[3] & (1u << 26);
+      f.sse41 = r[2] & (1u << 19);
+
+      // the OS must also save the wider registers on context switch
+      u64 xcr0 = (r[2] & (1u << 27)) ? xgetbv(0) : 0;
+      bool ymm = (xcr0 & 0x06) == 0x06;
+      bool zmm = (xcr0 & 0xE6) == 0xE6;
+      f.avx = ymm && (r[2] & (1u << 28));
+      f.fma = f.avx && (r[2] & (1u << 12));
+
+      if (max_leaf >= 7)
+      {
+        cpuid(7, 0, r);
+        f.avx2 = f.avx && (r[1] & (1u << 5));
+        f.avx512f = zmm && f.avx2 && f.fma && (r[1] & (1u << 16));
+      }
+#endif
+      return f;
     }
 
-    vec2 normalized()
+    inline const cpu_features &cpu()
     {
-      return vec2(*this).normalize();
+      static const cpu_features features = query_cpu_features();
+      return features;
     }
 
-    vec2 operator+(f32 s) const
+#ifdef JW_MATH_X86
+    // dot product of a and b in all four lanes
+    JW_MATH_TARGET("sse2") inline __m128 dot4_sse2(__m128 a, __m128 b)
     {
-      return vec2(x + s, y + s);
+      __m128 t = _mm_mul_ps(a, b);
+      t = _mm_add_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+      return _mm_add_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
     }
+#endif
 
-    vec2 operator-(f32 s) const
+    // Array kernels with a stream flag write their vector results with non-temporal
+    // stores when it is set, and end with an sfence. Their outputs must then be
+    // 16-byte aligned; scalar tails use ordinary stores.
+
+    inline size_t &stream_threshold_bytes()
     {
-      return vec2(x - s, y - s);
+      static size_t bytes = 1 << 20;
+      return bytes;
     }
 
-    vec2 operator*(f32 s) const
+    inline bool use_stream_stores(size_t bytes, const void *a, const void *b = nullptr, const void *c = nullptr, const void *d = nullptr)
     {
-      return vec2(x * s, y * s);
+      return bytes >= stream_threshold_bytes() && !((uintptr_t)a % 16) && !((uintptr_t)b % 16) && !((uintptr_t)c % 16) && !((uintptr_t)d % 16);
     }
 
-    vec2 operator/(f32 s) const
+#ifdef JW_MATH_X86
+    JW_MATH_TARGET("sse2") inline void store_sse2(f32 *p, __m128 v, bool stream)
     {
-      return vec2(x / s, y / s);
+      if (stream)
+        _mm_stream_ps(p, v);
+      else
+        _mm_storeu_ps(p, v);
     }
 
-    vec2 operator+(const vec2 &b) const
+    // streamed as two 16-byte halves, so that only 16-byte alignment is needed
+    JW_MATH_TARGET("avx") inline void store2_m128(f32 *p, __m256 v, bool stream)
     {
-      return vec2(x + b.x, y + b.y);
+      if (stream)
+      {
+        _mm_stream_ps(p, _mm256_castps256_ps128(v));
+        _mm_stream_ps(p + 4, _mm256_extractf128_ps(v, 1));
+      }
+      else
+        _mm256_storeu_ps(p, v);
     }
 
-    vec2 operator-(const vec2 &b) const
+    JW_MATH_TARGET("sse2") inline void stream_fence(bool stream)
     {
-      return vec2(x - b.x, y - b.y);
+      if (stream)
+        _mm_sfence();
     }
+#endif
 
-    vec2 &operator+=(f32 s)
+    // All mat4 kernels work on column-major f32[16] and allow r to alias a or b.
+
+    inline void mat4_mul_scalar(const f32 *a, const f32 *b, f32 *r)
     {
-      x += s;
-      y += s;
-      return *this;
+      f32 t[16];
+      for (int c = 0; c < 16; c += 4)
+        for (int i = 0; i < 4; i++)
+          t[c + i] = a[i] * b[c] + a[4 + i] * b[c + 1] + a[8 + i] * b[c + 2] + a[12 + i] * b[c + 3];
+      memcpy(r, t, sizeof(t));
     }
 
-    vec2 &operator-=(f32 s)
+#ifdef JW_MATH_X86
+    // column bc of a product with the columns of a held in registers
+    JW_MATH_TARGET("sse2") inline __m128 mat4_column_sse2(const __m128 a[4], __m128 bc)
     {
-      x -= s;
-      y -= s;
-      return *this;
+      __m128 rc = _mm_mul_ps(a[0], _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(0, 0, 0, 0)));
+      rc = _mm_add_ps(rc, _mm_mul_ps(a[1], _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(1, 1, 1, 1))));
+      rc = _mm_add_ps(rc, _mm_mul_ps(a[2], _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(2, 2, 2, 2))));
+      return _mm_add_ps(rc, _mm_mul_ps(a[3], _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(3, 3, 3, 3))));
     }
 
-    vec2 &operator*=(f32 s)
+    // the same without the fourth term, for a bc whose w is zero or implied
+    JW_MATH_TARGET("sse2") inline __m128 mat4_column3_sse2(const __m128 a[3], __m128 bc)
     {
-      x *= s;
-      y *= s;
-      return *this;
+      __m128 rc = _mm_mul_ps(a[0], _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(0, 0, 0, 0)));
+      rc = _mm_add_ps(rc, _mm_mul_ps(a[1], _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(1, 1, 1, 1))));
+      return _mm_add_ps(rc, _mm_mul_ps(a[2], _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(2, 2, 2, 2))));
     }
 
-    vec2 &operator/=(f32 s)
+    // unrolled so that, inlined into mat4::operator*, the result stays in registers
+    JW_MATH_TARGET("sse2") inline void mat4_mul_sse2(const f32 *a, const f32 *b, f32 *r)
     {
-      x /= s;
-      y /= s;
-      return *this;
+      __m128 ac[4] = {_mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8), _mm_loadu_ps(a + 12)};
+      __m128 r0 = mat4_column_sse2(ac, _mm_loadu_ps(b));
+      __m128 r1 = mat4_column_sse2(ac, _mm_loadu_ps(b + 4));
+      __m128 r2 = mat4_column_sse2(ac, _mm_loadu_ps(b + 8));
+      __m128 r3 = mat4_column_sse2(ac, _mm_loadu_ps(b + 12));
+      _mm_storeu_ps(r, r0);
+      _mm_storeu_ps(r + 4, r1);
+      _mm_storeu_ps(r + 8, r2);
+      _mm_storeu_ps(r + 12, r3);
     }
 
-    vec2 &operator+=(const vec2 &b)
+    JW_MATH_TARGET("avx") inline __m256 load2_m128(const f32 *lo, const f32 *hi)
     {
-      return *this = *this + b;
+      return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
     }
 
-    vec2 &operator-=(const vec2 &b)
+    // two result columns at once, with each column of a duplicated in both lanes
+    JW_MATH_TARGET("avx,fma") inline __m256 mat4_columns_avx(const __m256 a[4], __m256 bc)
     {
-      return *this = *this - b;
+      __m256 rc = _mm256_mul_ps(a[0], _mm256_shuffle_ps(bc, bc, _MM_SHUFFLE(0, 0, 0, 0)));
+      rc = _mm256_fmadd_ps(a[1], _mm256_shuffle_ps(bc, bc, _MM_SHUFFLE(1, 1, 1, 1)), rc);
+      rc = _mm256_fmadd_ps(a[2], _mm256_shuffle_ps(bc, bc, _MM_SHUFFLE(2, 2, 2, 2)), rc);
+      return _mm256_fmadd_ps(a[3], _mm256_shuffle_ps(bc, bc, _MM_SHUFFLE(3, 3, 3, 3)), rc);
     }
-  };
 
-  struct vec3
-  {
-    f32 x, y, z;
-    vec3(f32 s) : x(s), y(s), z(s) {}
-    vec3(f32 x, f32 y, f32 z) : x(x), y(y), z(z) {}
-    vec3(vec2 v, f32 z = 0.0F) : x(v.x), y(v.y), z(z) {}
+    JW_MATH_TARGET("avx,fma") inline void mat4_mul_avx(const f32 *a, const f32 *b, f32 *r)
+    {
+      __m256 ac[4] = {load2_m128(a, a), load2_m128(a + 4, a + 4), load2_m128(a + 8, a + 8), load2_m128(a + 12, a + 12)};
+      for (int c = 0; c < 16; c += 8)
+        _mm256_storeu_ps(r + c, mat4_columns_avx(ac, _mm256_loadu_ps(b + c)));
+    }
+#endif
 
-    void print(bool print_type = true, FILE* output = stdout) const
+    // Columns 0..n-1 (n <= 3) of a * b for a b whose fourth row is zero there,
+    // i.e. a[0] * b.x + a[1] * b.y + a[2] * b.z per column, in the operation order
+    // of the mat4_mul kernel with the same suffix so the results match the full
+    // product. r may alias a or b.
+    inline void mat4_mul_columns3_scalar(const f32 *a, const f32 *b, f32 *r, int n)
     {
-      if (print_type)
-        fprintf(output, "vec3\n");
-      fprintf(output, "--          --\n| %.4e |\n| %.4e |\n| %.4e |\n--          --\n", x, y, z);
+      f32 t[12];
+      for (int c = 0; c < 4 * n; c += 4)
+        for (int i = 0; i < 4; i++)
+          t[c + i] = a[i] * b[c] + a[4 + i] * b[c + 1] + a[8 + i] * b[c + 2];
+      memcpy(r, t, 4 * n * sizeof(f32));
     }
 
-    f32 dot(const vec3 &b) const
+#ifdef JW_MATH_X86
+    JW_MATH_TARGET("sse2") inline void mat4_mul_columns3_sse2(const f32 *a, const f32 *b, f32 *r, int n)
     {
-      return x * b.x + y * b.y + z * b.z;
+      __m128 ac[3] = {_mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8)}, rc[3];
+      for (int c = 0; c < n; c++)
+        rc[c] = mat4_column3_sse2(ac, _mm_loadu_ps(b + 4 * c));
+      for (int c = 0; c < n; c++)
+        _mm_storeu_ps(r + 4 * c, rc[c]);
     }
+#endif
 
-    f32 length_squared() const
+    // the kernel matching mat4::operator*, which mat4::translate and rotate use
+    inline void mat4_mul_columns3(const f32 *a, const f32 *b, f32 *r, int n)
     {
-      return dot(*this);
+#ifdef JW_MATH_SSE2
+      mat4_mul_columns3_sse2(a, b, r, n);
+#else
+      mat4_mul_columns3_scalar(a, b, r, n);
+#endif
     }
 
-    f32 length() const
+    // Each output lane is ((c0 * x + c1 * y) + c2 * z) + c3 * w on every path, without
+    // FMA, so results match the scalar kernel bit for bit.
+
+    inline void mat4_mul_vec4_scalar(const f32 *m, const f32 *v, f32 *r)
     {
-      return sqrtf(length_squared());
+      f32 t[4];
+      for (int i = 0; i < 4; i++)
+        t[i] = m[i] * v[0] + m[4 + i] * v[1] + m[8 + i] * v[2] + m[12 + i] * v[3];
+      memcpy(r, t, sizeof(t));
     }
 
-    vec3 &normalize()
+#ifdef JW_MATH_X86
+    JW_MATH_TARGET("sse2") inline void mat4_mul_vec4_sse2(const f32 *m, const f32 *v, f32 *r)
     {
-      f32 l = length();
-      x /= l;
-      y /= l;
-      z /= l;
-      return *this;
+      __m128 b = _mm_loadu_ps(v);
+      __m128 t = _mm_mul_ps(_mm_loadu_ps(m), _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 0, 0, 0)));
+      t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(m + 4), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 1, 1))));
+      t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(m + 8), _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 2, 2))));
+      t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(m + 12), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 3, 3))));
+      _mm_storeu_ps(r, t);
     }
+#endif
 
-    vec3 normalized()
+    // Batched products prefetch this many matrices ahead of the current one.
+    const size_t MAT4_PREFETCH_DISTANCE = 8;
+
+    inline void mat4_mul_batch_scalar(const f32 *a, const f32 *b, f32 *r, size_t n)
     {
-      return vec3(*this).normalize();
+      for (size_t i = 0; i < n; i++)
+        mat4_mul_scalar(a + 16 * i, b + 16 * i, r + 16 * i);
     }
 
-    vec3 cross(const vec3 &b)
+#ifdef JW_MATH_X86
+    JW_MATH_TARGET("sse2") inline void mat4_prefetch(const f32 *a, const f32 *b, size_t i, size_t n)
     {
-      return vec3(y * b.z - z * b.y, z * b.x - x * b.z, x * b.y - y * b.x);
+      if (i + MAT4_PREFETCH_DISTANCE < n)
+      {
+        _mm_prefetch((const char *)(a + 16 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+        _mm_prefetch((const char *)(b + 16 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+      }
     }
 
-    vec3 operator+(f32 s) const
+    JW_MATH_TARGET("sse2") inline void mat4_mul_batch_sse2(const f32 *a, const f32 *b, f32 *r, size_t n)
     {
-      return vec3(x + s, y + s, z + s);
+      for (size_t i = 0; i < n; i++)
+      {
+        mat4_prefetch(a, b, i, n);
+        mat4_mul_sse2(a + 16 * i, b + 16 * i, r + 16 * i);
+      }
     }
 
-    vec3 operator-(f32 s) const
+    // two independent products per iteration so their FMA chains overlap
+    JW_MATH_TARGET("avx,fma") inline void mat4_mul_batch_avx(const f32 *a, const f32 *b, f32 *r, size_t n)
     {
-      return vec3(x - s, y - s, z - s);
+      size_t i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        mat4_prefetch(a, b, i, n);
+        mat4_prefetch(a, b, i + 1, n);
+        mat4_mul_avx(a + 16 * i, b + 16 * i, r + 16 * i);
+        mat4_mul_avx(a + 16 * i + 16, b + 16 * i + 16, r + 16 * i + 16);
+      }
+      if (i < n)
+        mat4_mul_avx(a + 16 * i, b + 16 * i, r + 16 * i);
     }
 
-    vec3 operator*(f32 s) const
+    // The zero-masked forms below compile to the same instructions as the unmasked
+    // ones, which GCC 12 flags with spurious -Wmaybe-uninitialized warnings.
+
+    JW_MATH_TARGET("avx512f") inline __m512 load4_m128(const f32 *p)
     {
-      return vec3(x * s, y * s, z * s);
+      return _mm512_maskz_broadcast_f32x4(0xFFFF, _mm_loadu_ps(p));
     }
 
-    vec3 operator/(f32 s) const
+    template <int i>
+    JW_MATH_TARGET("avx512f") inline __m512 splat_lanes(__m512 v)
     {
-      return vec3(x / s, y / s, z / s);
+      return _mm512_maskz_shuffle_ps(0xFFFF, v, v, _MM_SHUFFLE(i, i, i, i));
     }
 
-    vec3 operator+(const vec3 &b) const
+    // a whole matrix per zmm register: each column of a is broadcast to all four lanes
+    JW_MATH_TARGET("avx512f") inline void mat4_mul_avx512(const f32 *a, const f32 *b, f32 *r)
     {
-      return vec3(x + b.x, y + b.y, z + b.z);
+      __m512 bm = _mm512_loadu_ps(b);
+      __m512 rm = _mm512_mul_ps(load4_m128(a), splat_lanes<0>(bm));
+      rm = _mm512_fmadd_ps(load4_m128(a + 4), splat_lanes<1>(bm), rm);
+      rm = _mm512_fmadd_ps(load4_m128(a + 8), splat_lanes<2>(bm), rm);
+      rm = _mm512_fmadd_ps(load4_m128(a + 12), splat_lanes<3>(bm), rm);
+      _mm512_storeu_ps(r, rm);
     }
 
-    vec3 operator-(const vec3 &b) const
+    JW_MATH_TARGET("avx512f") inline void mat4_mul_batch_avx512(const f32 *a, const f32 *b, f32 *r, size_t n)
     {
-      return vec3(x - b.x, y - b.y, y - b.y);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        for (size_t j = i; j < i + 4; j++)
+          mat4_prefetch(a, b, j, n);
+        mat4_mul_avx512(a + 16 * i, b + 16 * i, r + 16 * i);
+        mat4_mul_avx512(a + 16 * i + 16, b + 16 * i + 16, r + 16 * i + 16);
+        mat4_mul_avx512(a + 16 * i + 32, b + 16 * i + 32, r + 16 * i + 32);
+        mat4_mul_avx512(a + 16 * i + 48, b + 16 * i + 48, r + 16 * i + 48);
+      }
+      for (; i < n; i++)
+        mat4_mul_avx512(a + 16 * i, b + 16 * i, r + 16 * i);
     }
+#endif
 
-    vec3 &operator+=(f32 s)
+    // SoA transform: out[r][i] = row r of m * (in[0][i], in[1][i], in[2][i], in[3][i]).
+    // A null in[3] means w = 1 and out[3] is left untouched. Outputs may alias
+    // the inputs element for element.
+
+    inline void transform_soa_scalar(const f32 *m, const f32 *const in[4], f32 *const out[4], size_t n, bool)
     {
-      x += s;
-      y += s;
-      z += s;
-      return *this;
+      for (size_t i = 0; i < n; i++)
+      {
+        f32 x = in[0][i], y = in[1][i], z = in[2][i], w = in[3] ? in[3][i] : 1.0F;
+        f32 t[4];
+        for (int r = 0; r < 4; r++)
+          t[r] = m[r] * x + m[4 + r] * y + m[8 + r] * z + m[12 + r] * w;
+        for (int r = 0; r < (in[3] ? 4 : 3); r++)
+          out[r][i] = t[r];
+      }
     }
 
-    vec3 &operator-=(f32 s)
+#ifdef JW_MATH_X86
+    // 8 points per iteration; the tail uses fmaf in the same order as the vector lanes
+    template <int rows>
+    JW_MATH_TARGET("avx2,fma") inline void transform_soa_avx2_impl(const f32 *m, const f32 *const in[4], f32 *const out[4], size_t n, bool stream)
     {
-      x -= s;
-      y -= s;
-      z -= s;
-      return *this;
+      __m256 c[16];
+      for (int j = 0; j < 16; j++)
+        c[j] = _mm256_set1_ps(m[j]);
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 x = _mm256_loadu_ps(in[0] + i);
+        __m256 y = _mm256_loadu_ps(in[1] + i);
+        __m256 z = _mm256_loadu_ps(in[2] + i);
+        __m256 w = rows == 4 ? _mm256_loadu_ps(in[3] + i) : _mm256_set1_ps(1.0F);
+        __m256 t[rows];
+        for (int r = 0; r < rows; r++)
+          t[r] = _mm256_fmadd_ps(c[12 + r], w, _mm256_fmadd_ps(c[8 + r], z, _mm256_fmadd_ps(c[4 + r], y, _mm256_mul_ps(c[r], x))));
+        for (int r = 0; r < rows; r++)
+          store2_m128(out[r] + i, t[r], stream);
+      }
+      for (; i < n; i++)
+      {
+        f32 x = in[0][i], y = in[1][i], z = in[2][i], w = rows == 4 ? in[3][i] : 1.0F;
+        f32 t[rows];
+        for (int r = 0; r < rows; r++)
+          t[r] = fmaf(m[12 + r], w, fmaf(m[8 + r], z, fmaf(m[4 + r], y, m[r] * x)));
+        for (int r = 0; r < rows; r++)
+          out[r][i] = t[r];
+      }
+      stream_fence(stream);
     }
 
-    vec3 &operator*=(f32 s)
+    JW_MATH_TARGET("avx2,fma") inline void transform_soa_avx2(const f32 *m, const f32 *const in[4], f32 *const out[4], size_t n, bool stream)
     {
-      x *= s;
-      y *= s;
-      z *= s;
-      return *this;
+      if (in[3])
+        transform_soa_avx2_impl<4>(m, in, out, n, stream);
+      else
+        transform_soa_avx2_impl<3>(m, in, out, n, stream);
     }
 
-    vec3 &operator/=(f32 s)
+    // a 16-byte aligned zmm store as four non-temporal xmm stores; the maskz forms
+    // avoid a spurious -Wmaybe-uninitialized in GCC 12
+    JW_MATH_TARGET("avx512f") inline void stream4_m128(f32 *p, __m512 v)
     {
-      x /= s;
-      y /= s;
-      z /= s;
-      return *this;
+      _mm_stream_ps(p, _mm512_maskz_extractf32x4_ps(0xF, v, 0));
+      _mm_stream_ps(p + 4, _mm512_maskz_extractf32x4_ps(0xF, v, 1));
+      _mm_stream_ps(p + 8, _mm512_maskz_extractf32x4_ps(0xF, v, 2));
+      _mm_stream_ps(p + 12, _mm512_maskz_extractf32x4_ps(0xF, v, 3));
     }
 
-    vec3 &operator+=(const vec3 &b)
+    // 16 points per iteration with all 16 matrix elements held in broadcast registers;
+    // the tail is handled with masked loads and stores
+    template <int rows>
+    JW_MATH_TARGET("avx512f") inline void transform_soa_avx512_impl(const f32 *m, const f32 *const in[4], f32 *const out[4], size_t n, bool stream)
     {
-      return *this = *this + b;
+      __m512 c[16];
+      for (int j = 0; j < 16; j++)
+        c[j] = _mm512_set1_ps(m[j]);
+
+      for (size_t i = 0; i < n; i += 16)
+      {
+        __mmask16 k = n - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __m512 x = _mm512_maskz_loadu_ps(k, in[0] + i);
+        __m512 y = _mm512_maskz_loadu_ps(k, in[1] + i);
+        __m512 z = _mm512_maskz_loadu_ps(k, in[2] + i);
+        __m512 w = rows == 4 ? _mm512_maskz_loadu_ps(k, in[3] + i) : _mm512_set1_ps(1.0F);
+        __m512 t[rows];
+        for (int r = 0; r < rows; r++)
+          t[r] = _mm512_fmadd_ps(c[12 + r], w, _mm512_fmadd_ps(c[8 + r], z, _mm512_fmadd_ps(c[4 + r], y, _mm512_mul_ps(c[r], x))));
+        for (int r = 0; r < rows; r++)
+        {
+          if (stream && k == 0xFFFF)
+            stream4_m128(out[r] + i, t[r]);
+          else
+            _mm512_mask_storeu_ps(out[r] + i, k, t[r]);
+        }
+      }
+      stream_fence(stream);
     }
 
-    vec3 &operator-=(const vec3 &b)
+    JW_MATH_TARGET("avx512f") inline void transform_soa_avx512(const f32 *m, const f32 *const in[4], f32 *const out[4], size_t n, bool stream)
     {
-      return *this = *this - b;
+      if (in[3])
+        transform_soa_avx512_impl<4>(m, in, out, n, stream);
+      else
+        transform_soa_avx512_impl<3>(m, in, out, n, stream);
     }
-  };
+#endif
 
-  struct vec4
-  {
-    f32 x, y, z, w;
-    vec4(f32 s) : x(s), y(s), z(s), w(s) {}
-    vec4(f32 x, f32 y, f32 z, f32 w) : x(x), y(y), z(z), w(w) {}
-    vec4(vec3 v, f32 w = 0.0F) : x(v.x), y(v.y), z(v.z), w(w) {}
+#ifdef JW_MATH_X86
+    // rsqrtps refined by one Newton-Raphson step, y * (1.5 - 0.5 * x * y * y). The
+    // relative error is below 5e-7 (about 4 ulp, against 3.7e-4 for rsqrtps alone).
+    // Lanes with x < FLT_MIN, including zero, return 0 rather than inf or NaN.
+    JW_MATH_TARGET("sse2") inline __m128 rsqrt_nr_sse2(__m128 x)
+    {
+      __m128 y = _mm_rsqrt_ps(x);
+      y = _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5F), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5F), x), _mm_mul_ps(y, y))));
+      return _mm_and_ps(y, _mm_cmpge_ps(x, _mm_set1_ps(FLT_MIN)));
+    }
+#endif
 
-    void print(bool print_type = true, FILE* output = stdout) const
+    inline f32 rsqrt_fast(f32 x)
     {
-      if (print_type)
-        fprintf(output, "vec4\n");
-      fprintf(output, "--          --\n| %.4e |\n| %.4e |\n| %.4e |\n| %.4e |\n--          --\n", x, y, z, w);
+#ifdef JW_MATH_SSE2
+      return _mm_cvtss_f32(rsqrt_nr_sse2(_mm_set_ss(x)));
+#else
+      return x >= FLT_MIN ? 1.0F / sqrtf(x) : 0.0F;
+#endif
     }
 
-    f32 dot(const vec4 &b) const
+    // Batch normalize of tightly packed vec3 (stride 3) or vec4 (stride 4) arrays.
+
+    inline void normalize3_scalar(f32 *v, size_t n)
     {
-      return x * b.x + y * b.y + z * b.z + w * b.w;
+      for (size_t i = 0; i < 3 * n; i += 3)
+      {
+        f32 l = sqrtf(v[i] * v[i] + v[i + 1] * v[i + 1] + v[i + 2] * v[i + 2]);
+        v[i] /= l;
+        v[i + 1] /= l;
+        v[i + 2] /= l;
+      }
     }
 
-    f32 length_squared() const
+    inline void normalize4_scalar(f32 *v, size_t n)
     {
-      return dot(*this);
+      for (size_t i = 0; i < 4 * n; i += 4)
+      {
+        f32 l = sqrtf(v[i] * v[i] + v[i + 1] * v[i + 1] + v[i + 2] * v[i + 2] + v[i + 3] * v[i + 3]);
+        v[i] /= l;
+        v[i + 1] /= l;
+        v[i + 2] /= l;
+        v[i + 3] /= l;
+      }
     }
 
-    f32 length() const
+#ifdef JW_MATH_X86
+    // [x0 y0 z0 x1] [y1 z1 x2 y2] [z2 x3 y3 z3] <-> [x0 x1 x2 x3] [y0 y1 y2 y3] [z0 z1 z2 z3]
+
+    JW_MATH_TARGET("sse2") inline void deinterleave3_sse2(__m128 a, __m128 b, __m128 c, __m128 &x, __m128 &y, __m128 &z)
     {
-      return sqrtf(length_squared());
+      x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+      y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+      z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
     }
 
-    vec4 &normalize()
+    JW_MATH_TARGET("sse2") inline void interleave3_sse2(__m128 x, __m128 y, __m128 z, __m128 &a, __m128 &b, __m128 &c)
     {
-      f32 l = length();
-      x /= l;
-      y /= l;
-      z /= l;
-      w /= l;
-      return *this;
+      a = _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+      b = _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+      c = _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
     }
 
-    vec4 normalized()
+    // SSE4.1 form: each output gathers its lanes with two blends, which are not
+    // limited to the shuffle port, and is put in order with a single shuffle.
+    JW_MATH_TARGET("sse4.1") inline void deinterleave3_sse41(__m128 a, __m128 b, __m128 c, __m128 &x, __m128 &y, __m128 &z)
     {
-      return vec4(*this).normalize();
+      __m128 tx = _mm_blend_ps(_mm_blend_ps(a, b, 0x4), c, 0x2); // x0 x3 x2 x1
+      __m128 ty = _mm_blend_ps(_mm_blend_ps(a, b, 0x9), c, 0x4); // y1 y0 y3 y2
+      __m128 tz = _mm_blend_ps(_mm_blend_ps(a, b, 0x2), c, 0x9); // z2 z1 z0 z3
+      x = _mm_shuffle_ps(tx, tx, _MM_SHUFFLE(1, 2, 3, 0));
+      y = _mm_shuffle_ps(ty, ty, _MM_SHUFFLE(2, 3, 0, 1));
+      z = _mm_shuffle_ps(tz, tz, _MM_SHUFFLE(3, 0, 1, 2));
     }
 
-    vec4 operator+(f32 s) const
+    JW_MATH_TARGET("sse4.1") inline void interleave3_sse41(__m128 x, __m128 y, __m128 z, __m128 &a, __m128 &b, __m128 &c)
     {
-      return vec4(x + s, y + s, z + s, w + s);
+      __m128 tx = _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 2, 3, 0));
+      __m128 ty = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+      __m128 tz = _mm_shuffle_ps(z, z, _MM_SHUFFLE(3, 0, 1, 2));
+      a = _mm_blend_ps(_mm_blend_ps(tx, ty, 0x2), tz, 0x4);
+      b = _mm_blend_ps(_mm_blend_ps(tx, ty, 0x9), tz, 0x2);
+      c = _mm_blend_ps(_mm_blend_ps(tx, ty, 0x4), tz, 0x9);
     }
 
-    vec4 operator-(f32 s) const
+    // Eight vec3: the SSE2 shuffles work unchanged within each 128-bit lane when
+    // vec3 0-3 and 4-7 are loaded into the low and high halves.
+
+    JW_MATH_TARGET("avx") inline void load_deinterleave3_avx(const f32 *p, __m256 &x, __m256 &y, __m256 &z)
     {
-      return vec4(x - s, y - s, z - s, w - s);
+      __m256 a = load2_m128(p, p + 12), b = load2_m128(p + 4, p + 16), c = load2_m128(p + 8, p + 20);
+      x = _mm256_shuffle_ps(a, _mm256_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+      y = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm256_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+      z = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
     }
 
-    vec4 operator*(f32 s) const
+    JW_MATH_TARGET("avx") inline void interleave3_store_avx(__m256 x, __m256 y, __m256 z, f32 *p, bool stream)
     {
-      return vec4(x * s, y * s, z * s, w * s);
+      __m256 a = _mm256_shuffle_ps(_mm256_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)), _mm256_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+      __m256 b = _mm256_shuffle_ps(_mm256_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), _mm256_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+      __m256 c = _mm256_shuffle_ps(_mm256_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm256_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+      store_sse2(p, _mm256_castps256_ps128(a), stream);
+      store_sse2(p + 4, _mm256_castps256_ps128(b), stream);
+      store_sse2(p + 8, _mm256_castps256_ps128(c), stream);
+      store_sse2(p + 12, _mm256_extractf128_ps(a, 1), stream);
+      store_sse2(p + 16, _mm256_extractf128_ps(b, 1), stream);
+      store_sse2(p + 20, _mm256_extractf128_ps(c, 1), stream);
     }
 
-    vec4 operator/(f32 s) const
+    // _MM_TRANSPOSE4_PS within each 128-bit lane
+    JW_MATH_TARGET("avx") inline void transpose4_avx(__m256 &a, __m256 &b, __m256 &c, __m256 &d)
     {
-      return vec4(x / s, y / s, z / s, w / s);
+      __m256 t0 = _mm256_unpacklo_ps(a, b), t1 = _mm256_unpackhi_ps(a, b);
+      __m256 t2 = _mm256_unpacklo_ps(c, d), t3 = _mm256_unpackhi_ps(c, d);
+      a = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+      b = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+      c = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+      d = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
     }
 
-    vec4 operator+(const vec4 &b) const
+    // four vec3 per iteration, transposed to SoA in registers
+    JW_MATH_TARGET("sse2") inline void normalize3_sse2(f32 *v, size_t n)
     {
-      return vec4(x + b.x, y + b.y, z + b.z, w + b.w);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        f32 *p = v + 3 * i;
+        __m128 x, y, z;
+        deinterleave3_sse2(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), x, y, z);
+        __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        __m128 a, b, c;
+        interleave3_sse2(_mm_div_ps(x, l), _mm_div_ps(y, l), _mm_div_ps(z, l), a, b, c);
+        _mm_storeu_ps(p, a);
+        _mm_storeu_ps(p + 4, b);
+        _mm_storeu_ps(p + 8, c);
+      }
+      normalize3_scalar(v + 3 * i, n - i);
     }
 
-    vec4 operator-(const vec4 &b) const
+    JW_MATH_TARGET("sse4.1") inline void normalize3_sse41(f32 *v, size_t n)
     {
-      return vec4(x - b.x, y - b.y, y - b.y, w - b.w);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        f32 *p = v + 3 * i;
+        __m128 x, y, z;
+        deinterleave3_sse41(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), x, y, z);
+        __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        __m128 a, b, c;
+        interleave3_sse41(_mm_div_ps(x, l), _mm_div_ps(y, l), _mm_div_ps(z, l), a, b, c);
+        _mm_storeu_ps(p, a);
+        _mm_storeu_ps(p + 4, b);
+        _mm_storeu_ps(p + 8, c);
+      }
+      normalize3_scalar(v + 3 * i, n - i);
     }
 
-    vec4 &operator+=(f32 s)
+    JW_MATH_TARGET("sse2") inline void normalize4_sse2(f32 *v, size_t n)
     {
-      x += s;
-      y += s;
-      z += s;
-      w += s;
-      return *this;
+      for (size_t i = 0; i < 4 * n; i += 4)
+      {
+        __m128 a = _mm_loadu_ps(v + i);
+        __m128 t = _mm_mul_ps(a, a);
+        t = _mm_add_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+        t = _mm_add_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+        _mm_storeu_ps(v + i, _mm_div_ps(a, _mm_sqrt_ps(t)));
+      }
     }
 
-    vec4 &operator-=(f32 s)
+    // two vec4 per ymm register, reduced within each 128-bit lane
+    JW_MATH_TARGET("avx") inline void normalize4_avx(f32 *v, size_t n)
     {
-      x -= s;
-      y -= s;
-      z -= s;
-      w -= s;
-      return *this;
+      size_t i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        __m256 a = _mm256_loadu_ps(v + 4 * i);
+        __m256 t = _mm256_mul_ps(a, a);
+        t = _mm256_add_ps(t, _mm256_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+        t = _mm256_add_ps(t, _mm256_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+        _mm256_storeu_ps(v + 4 * i, _mm256_div_ps(a, _mm256_sqrt_ps(t)));
+      }
+      normalize4_sse2(v + 4 * i, n - i);
     }
+#endif
 
-    vec4 &operator*=(f32 s)
+    // Fast batch normalize: one Newton-Raphson step on the reciprocal square root
+    // estimate, see rsqrt_fast. Zero-length vectors are left at zero.
+
+    template <int dim>
+    inline void normalize_fast_scalar(f32 *v, size_t n)
     {
-      x *= s;
-      y *= s;
-      z *= s;
-      w *= s;
-      return *this;
+      for (size_t i = 0; i < dim * n; i += dim)
+      {
+        f32 l2 = 0;
+        for (int j = 0; j < dim; j++)
+          l2 += v[i + j] * v[i + j];
+        f32 r = l2 >= FLT_MIN ? 1.0F / sqrtf(l2) : 0.0F;
+        for (int j = 0; j < dim; j++)
+          v[i + j] *= r;
+      }
     }
 
-    vec4 &operator/=(f32 s)
+#ifdef JW_MATH_X86
+    // four vec2 per iteration: [x0 y0 x1 y1] [x2 y2 x3 y3] <-> [x0 x1 x2 x3] [y0 y1 y2 y3]
+    JW_MATH_TARGET("sse2") inline void normalize2_fast_sse2(f32 *v, size_t n)
     {
-      x /= s;
-      y /= s;
-      z /= s;
-      w /= s;
-      return *this;
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        f32 *p = v + 2 * i;
+        __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4);
+        __m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 r = rsqrt_nr_sse2(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+        x = _mm_mul_ps(x, r);
+        y = _mm_mul_ps(y, r);
+        _mm_storeu_ps(p, _mm_unpacklo_ps(x, y));
+        _mm_storeu_ps(p + 4, _mm_unpackhi_ps(x, y));
+      }
+      for (; i < n; i++)
+      {
+        __m128 a = _mm_castpd_ps(_mm_load_sd((const f64 *)(v + 2 * i)));
+        _mm_store_sd((f64 *)(v + 2 * i), _mm_castps_pd(_mm_mul_ps(a, rsqrt_nr_sse2(dot4_sse2(a, a)))));
+      }
     }
 
-    vec4 &operator+=(const vec4 &b)
+    JW_MATH_TARGET("sse2") inline void normalize3_fast_sse2(f32 *v, size_t n)
     {
-      return *this = *this + b;
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        f32 *p = v + 3 * i;
+        __m128 x, y, z;
+        deinterleave3_sse2(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), x, y, z);
+        __m128 r = rsqrt_nr_sse2(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        __m128 a, b, c;
+        interleave3_sse2(_mm_mul_ps(x, r), _mm_mul_ps(y, r), _mm_mul_ps(z, r), a, b, c);
+        _mm_storeu_ps(p, a);
+        _mm_storeu_ps(p + 4, b);
+        _mm_storeu_ps(p + 8, c);
+      }
+      for (; i < n; i++)
+      {
+        f32 *p = v + 3 * i;
+        __m128 a = _mm_setr_ps(p[0], p[1], p[2], 0);
+        __m128 r = _mm_mul_ps(a, rsqrt_nr_sse2(dot4_sse2(a, a)));
+        p[0] = _mm_cvtss_f32(r);
+        p[1] = _mm_cvtss_f32(_mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 1, 1, 1)));
+        p[2] = _mm_cvtss_f32(_mm_movehl_ps(r, r));
+      }
     }
 
-    vec4 &operator-=(const vec4 &b)
+    JW_MATH_TARGET("sse2") inline void normalize4_fast_sse2(f32 *v, size_t n)
     {
-      return *this = *this - b;
+      for (size_t i = 0; i < 4 * n; i += 4)
+      {
+        __m128 a = _mm_loadu_ps(v + i);
+        _mm_storeu_ps(v + i, _mm_mul_ps(a, rsqrt_nr_sse2(dot4_sse2(a, a))));
+      }
     }
-  };
 
-  struct quat
-  {
-    f32 x, y, z, w;
-    quat(f32 x, f32 y, f32 z, f32 w) : x(x), y(y), z(z), w(w) {}
-    quat(vec3 axis, f32 angle) : x(axis.x * sinf(angle / 2)), y(axis.y * sinf(angle / 2)), z(axis.z * sinf(angle / 2)), w(cosf(angle / 2)) {}
-  };
+    JW_MATH_TARGET("avx") inline void normalize4_fast_avx(f32 *v, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        __m256 a = _mm256_loadu_ps(v + 4 * i);
+        __m256 t = _mm256_mul_ps(a, a);
+        t = _mm256_add_ps(t, _mm256_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+        t = _mm256_add_ps(t, _mm256_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m256 r = _mm256_rsqrt_ps(t);
+        r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(1.5F), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5F), t), _mm256_mul_ps(r, r))));
+        r = _mm256_and_ps(r, _mm256_cmp_ps(t, _mm256_set1_ps(FLT_MIN), _CMP_GE_OQ));
+        _mm256_storeu_ps(v + 4 * i, _mm256_mul_ps(a, r));
+      }
+      normalize4_fast_sse2(v + 4 * i, n - i);
+    }
+#endif
 
-  struct mat4
-  {
-    f32 m00 = 0, m01 = 0, m02 = 0, m03 = 0,
-        m10 = 0, m11 = 0, m12 = 0, m13 = 0,
-        m20 = 0, m21 = 0, m22 = 0, m23 = 0,
-        m30 = 0, m31 = 0, m32 = 0, m33 = 0;
-    mat4(f32 s = 1.0F) : m00(s), m11(s), m22(s), m33(s) {}
-    mat4(const quat &q)
+    // quat (x, y, z, w) to a column-major rotation matrix.
+
+    inline void quat_to_mat4_scalar(const f32 *q, f32 *m)
     {
-      f32 x = q.x, y = q.y, z = q.z, w = q.w;
+      f32 x = q[0], y = q[1], z = q[2], w = q[3];
       f32 xx = x * x, xy = x * y, xz = x * z, xw = x * w;
       f32 yy = y * y, yz = y * z, yw = y * w;
       f32 zz = z * z, zw = z * w;
 
-      m00 = 1 - 2 * (yy + zz);
-      m10 = 2 * (xy - zw);
-      m20 = 2 * (xz + yw);
+      m[0] = 1 - 2 * (yy + zz);
+      m[1] = 2 * (xy + zw);
+      m[2] = 2 * (xz - yw);
+      m[3] = 0;
 
-      m01 = 2 * (xy + zw);
-      m11 = 1 - 2 * (xx + zz);
-      m21 = 2 * (yz - xw);
+      m[4] = 2 * (xy - zw);
+      m[5] = 1 - 2 * (xx + zz);
+      m[6] = 2 * (yz + xw);
+      m[7] = 0;
 
-      m02 = 2 * (xz - yw);
-      m12 = 2 * (yz + xw);
-      m22 = 1 - 2 * (xx + yy);
+      m[8] = 2 * (xz + yw);
+      m[9] = 2 * (yz - xw);
+      m[10] = 1 - 2 * (xx + yy);
+      m[11] = 0;
 
-      m30 = m31 = m32 = m03 = m13 = m23 = 0;
-      m33 = 1;
+      m[12] = m[13] = m[14] = 0;
+      m[15] = 1;
     }
 
-    void print(bool print_type = true, FILE* output = stdout) const
-    {
-      if (print_type)
-        fprintf(output, "mat4\n");
+#ifdef JW_MATH_X86
+    // Each column is e + a * b + c * d with a, c taken from 2q and b, d from q,
+    // e.g. column 0 = (1, 0, 0) + (2y, 2y, 2z) * (-y, x, x) + (2z, 2z, 2y) * (-z, w, -w).
+    // The shuffles a, b, c, d select those lanes, the signs are applied with xor
+    // masks and lane 3 is cleared at the end.
+
+    template <int a, int b, int c, int d>
+    JW_MATH_TARGET("sse2") inline __m128 quat_column_sse2(__m128 q, __m128 q2, __m128 e, __m128 b_sign, __m128 d_sign)
+    {
+      __m128 t = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(q2, q2, a), _mm_xor_ps(_mm_shuffle_ps(q, q, b), b_sign)),
+                            _mm_mul_ps(_mm_shuffle_ps(q2, q2, c), _mm_xor_ps(_mm_shuffle_ps(q, q, d), d_sign)));
+      return _mm_add_ps(e, _mm_and_ps(t, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0))));
+    }
+
+    JW_MATH_TARGET("sse2") inline void quat_to_mat4_sse2(const f32 *p, f32 *m)
+    {
+      __m128 q = _mm_loadu_ps(p);
+      __m128 q2 = _mm_add_ps(q, q);
+      _mm_storeu_ps(m, quat_column_sse2<_MM_SHUFFLE(0, 2, 1, 1), _MM_SHUFFLE(0, 0, 0, 1), _MM_SHUFFLE(0, 1, 2, 2), _MM_SHUFFLE(0, 3, 3, 2)>(
+                           q, q2, _mm_setr_ps(1, 0, 0, 0), _mm_setr_ps(-0.0F, 0, 0, 0), _mm_setr_ps(-0.0F, 0, -0.0F, 0)));
+      _mm_storeu_ps(m + 4, quat_column_sse2<_MM_SHUFFLE(0, 2, 0, 0), _MM_SHUFFLE(0, 1, 0, 1), _MM_SHUFFLE(0, 0, 2, 2), _MM_SHUFFLE(0, 3, 2, 3)>(
+                               q, q2, _mm_setr_ps(0, 1, 0, 0), _mm_setr_ps(0, -0.0F, 0, 0), _mm_setr_ps(-0.0F, -0.0F, 0, 0)));
+      _mm_storeu_ps(m + 8, quat_column_sse2<_MM_SHUFFLE(0, 0, 1, 0), _MM_SHUFFLE(0, 0, 2, 2), _MM_SHUFFLE(0, 1, 0, 1), _MM_SHUFFLE(0, 1, 3, 3)>(
+                               q, q2, _mm_setr_ps(0, 0, 1, 0), _mm_setr_ps(0, 0, -0.0F, 0), _mm_setr_ps(0, -0.0F, -0.0F, 0)));
+      _mm_storeu_ps(m + 12, _mm_setr_ps(0, 0, 0, 1));
+    }
+#endif
+
+    // SoA quats q[0..3] to mat4s, or to affine3s (the top three rows) when affine is
+    // set. A non-null t (translation) and s (scale) give the same result as
+    // mat4().translate(t).rotate(q).scale(s) without the products.
+
+    inline void quat_to_mat4_soa_scalar(const f32 *const q[4], const f32 *const t[3], const f32 *const s[3], f32 *out, size_t n, bool affine, bool)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        f32 m[16];
+        f32 p[4] = {q[0][i], q[1][i], q[2][i], q[3][i]};
+        quat_to_mat4_scalar(p, m);
+        for (int c = 0; s[0] && c < 3; c++)
+          for (int r = 0; r < 3; r++)
+            m[4 * c + r] *= s[c][i];
+        for (int r = 0; t[0] && r < 3; r++)
+          m[12 + r] = t[r][i];
+        if (affine)
+          for (int c = 0; c < 4; c++)
+            memcpy(out + 12 * i + 3 * c, m + 4 * c, 3 * sizeof(f32));
+        else
+          memcpy(out + 16 * i, m, sizeof(m));
+      }
+    }
+
+#ifdef JW_MATH_X86
+    // The matrix entries are computed as in quat_to_mat4_scalar, 4 quats per iteration,
+    // then each column block is transposed into the four output matrices. For affine3
+    // output the 12 rows-0..2 entries are taken in storage order and transposed four
+    // at a time instead.
+    JW_MATH_TARGET("sse2") inline void quat_to_mat4_soa_sse2(const f32 *const q[4], const f32 *const t[3], const f32 *const s[3], f32 *out, size_t n, bool affine, bool stream)
+    {
+      const __m128 one = _mm_set1_ps(1.0F), two = _mm_set1_ps(2.0F);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 x = _mm_loadu_ps(q[0] + i), y = _mm_loadu_ps(q[1] + i), z = _mm_loadu_ps(q[2] + i), w = _mm_loadu_ps(q[3] + i);
+        __m128 xx = _mm_mul_ps(x, x), xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), xw = _mm_mul_ps(x, w);
+        __m128 yy = _mm_mul_ps(y, y), yz = _mm_mul_ps(y, z), yw = _mm_mul_ps(y, w);
+        __m128 zz = _mm_mul_ps(z, z), zw = _mm_mul_ps(z, w);
+
+        __m128 c[4][4];
+        c[0][0] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+        c[0][1] = _mm_mul_ps(two, _mm_add_ps(xy, zw));
+        c[0][2] = _mm_mul_ps(two, _mm_sub_ps(xz, yw));
+        c[1][0] = _mm_mul_ps(two, _mm_sub_ps(xy, zw));
+        c[1][1] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+        c[1][2] = _mm_mul_ps(two, _mm_add_ps(yz, xw));
+        c[2][0] = _mm_mul_ps(two, _mm_add_ps(xz, yw));
+        c[2][1] = _mm_mul_ps(two, _mm_sub_ps(yz, xw));
+        c[2][2] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+        c[0][3] = c[1][3] = c[2][3] = _mm_setzero_ps();
+        c[3][3] = one;
+        for (int r = 0; r < 3; r++)
+          c[3][r] = t[0] ? _mm_loadu_ps(t[r] + i) : _mm_setzero_ps();
+        for (int k = 0; s[0] && k < 3; k++)
+        {
+          __m128 sk = _mm_loadu_ps(s[k] + i);
+          for (int r = 0; r < 3; r++)
+            c[k][r] = _mm_mul_ps(c[k][r], sk);
+        }
+
+        if (affine)
+        {
+          __m128 a[12];
+          for (int k = 0; k < 4; k++)
+            for (int r = 0; r < 3; r++)
+              a[3 * k + r] = c[k][r];
+          for (int g = 0; g < 12; g += 4)
+          {
+            _MM_TRANSPOSE4_PS(a[g], a[g + 1], a[g + 2], a[g + 3]);
+            for (int j = 0; j < 4; j++)
+              store_sse2(out + 12 * (i + j) + g, a[g + j], stream);
+          }
+          continue;
+        }
+        for (int k = 0; k < 4; k++)
+        {
+          _MM_TRANSPOSE4_PS(c[k][0], c[k][1], c[k][2], c[k][3]);
+          for (int j = 0; j < 4; j++)
+            store_sse2(out + 16 * (i + j) + 4 * k, c[k][j], stream);
+        }
+      }
+      const f32 *qt[4] = {q[0] + i, q[1] + i, q[2] + i, q[3] + i};
+      const f32 *tt[3] = {t[0] ? t[0] + i : nullptr, t[0] ? t[1] + i : nullptr, t[0] ? t[2] + i : nullptr};
+      const f32 *st[3] = {s[0] ? s[0] + i : nullptr, s[0] ? s[1] + i : nullptr, s[0] ? s[2] + i : nullptr};
+      quat_to_mat4_soa_scalar(qt, tt, st, out + (affine ? 12 : 16) * i, n - i, affine, false);
+      stream_fence(stream);
+    }
+
+    // 8 quats per iteration; the in-lane transpose leaves matrix j in the low half
+    // and matrix j + 4 in the high half of each register
+    JW_MATH_TARGET("avx") inline void quat_to_mat4_soa_avx(const f32 *const q[4], const f32 *const t[3], const f32 *const s[3], f32 *out, size_t n, bool affine, bool stream)
+    {
+      const __m256 one = _mm256_set1_ps(1.0F), two = _mm256_set1_ps(2.0F);
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 x = _mm256_loadu_ps(q[0] + i), y = _mm256_loadu_ps(q[1] + i), z = _mm256_loadu_ps(q[2] + i), w = _mm256_loadu_ps(q[3] + i);
+        __m256 xx = _mm256_mul_ps(x, x), xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), xw = _mm256_mul_ps(x, w);
+        __m256 yy = _mm256_mul_ps(y, y), yz = _mm256_mul_ps(y, z), yw = _mm256_mul_ps(y, w);
+        __m256 zz = _mm256_mul_ps(z, z), zw = _mm256_mul_ps(z, w);
+
+        __m256 c[4][4];
+        c[0][0] = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz)));
+        c[0][1] = _mm256_mul_ps(two, _mm256_add_ps(xy, zw));
+        c[0][2] = _mm256_mul_ps(two, _mm256_sub_ps(xz, yw));
+        c[1][0] = _mm256_mul_ps(two, _mm256_sub_ps(xy, zw));
+        c[1][1] = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz)));
+        c[1][2] = _mm256_mul_ps(two, _mm256_add_ps(yz, xw));
+        c[2][0] = _mm256_mul_ps(two, _mm256_add_ps(xz, yw));
+        c[2][1] = _mm256_mul_ps(two, _mm256_sub_ps(yz, xw));
+        c[2][2] = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy)));
+        c[0][3] = c[1][3] = c[2][3] = _mm256_setzero_ps();
+        c[3][3] = one;
+        for (int r = 0; r < 3; r++)
+          c[3][r] = t[0] ? _mm256_loadu_ps(t[r] + i) : _mm256_setzero_ps();
+        for (int k = 0; s[0] && k < 3; k++)
+        {
+          __m256 sk = _mm256_loadu_ps(s[k] + i);
+          for (int r = 0; r < 3; r++)
+            c[k][r] = _mm256_mul_ps(c[k][r], sk);
+        }
+
+        if (affine)
+        {
+          __m256 a[12];
+          for (int k = 0; k < 4; k++)
+            for (int r = 0; r < 3; r++)
+              a[3 * k + r] = c[k][r];
+          for (int g = 0; g < 12; g += 4)
+          {
+            transpose4_avx(a[g], a[g + 1], a[g + 2], a[g + 3]);
+            for (int j = 0; j < 4; j++)
+            {
+              store_sse2(out + 12 * (i + j) + g, _mm256_castps256_ps128(a[g + j]), stream);
+              store_sse2(out + 12 * (i + j + 4) + g, _mm256_extractf128_ps(a[g + j], 1), stream);
+            }
+          }
+          continue;
+        }
+        for (int k = 0; k < 4; k++)
+        {
+          transpose4_avx(c[k][0], c[k][1], c[k][2], c[k][3]);
+          for (int j = 0; j < 4; j++)
+          {
+            store_sse2(out + 16 * (i + j) + 4 * k, _mm256_castps256_ps128(c[k][j]), stream);
+            store_sse2(out + 16 * (i + j + 4) + 4 * k, _mm256_extractf128_ps(c[k][j], 1), stream);
+          }
+        }
+      }
+      const f32 *qt[4] = {q[0] + i, q[1] + i, q[2] + i, q[3] + i};
+      const f32 *tt[3] = {t[0] ? t[0] + i : nullptr, t[0] ? t[1] + i : nullptr, t[0] ? t[2] + i : nullptr};
+      const f32 *st[3] = {s[0] ? s[0] + i : nullptr, s[0] ? s[1] + i : nullptr, s[0] ? s[2] + i : nullptr};
+      quat_to_mat4_soa_sse2(qt, tt, st, out + (affine ? 12 : 16) * i, n - i, affine, stream);
+    }
+#endif
+
+    // Transform of tightly packed vec3 arrays. out may be in, but must not otherwise
+    // overlap it.
+    enum class transform_kind
+    {
+      vector,       // w = 0
+      affine_point, // w = 1, bottom row of m is (0, 0, 0, 1)
+      point,        // w = 1, divided by the resulting w
+      normal        // w = 0, renormalized; m holds the normal matrix
+    };
+
+    constexpr bool translates(transform_kind kind)
+    {
+      return kind == transform_kind::affine_point || kind == transform_kind::point;
+    }
+
+    template <transform_kind kind>
+    inline void transform3_scalar_impl(const f32 *m, const f32 *in, f32 *out, size_t n)
+    {
+      for (size_t i = 0; i < 3 * n; i += 3)
+      {
+        f32 x = in[i], y = in[i + 1], z = in[i + 2];
+        f32 r[3];
+        for (int j = 0; j < 3; j++)
+        {
+          r[j] = m[j] * x + m[4 + j] * y + m[8 + j] * z;
+          if (translates(kind))
+            r[j] = r[j] + m[12 + j];
+        }
+        if (kind == transform_kind::point)
+        {
+          f32 w = m[3] * x + m[7] * y + m[11] * z + m[15];
+          for (int j = 0; j < 3; j++)
+            r[j] = r[j] / w;
+        }
+        if (kind == transform_kind::normal)
+        {
+          f32 l = sqrtf(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+          for (int j = 0; j < 3; j++)
+            r[j] = r[j] / l;
+        }
+        memcpy(out + i, r, sizeof(r));
+      }
+    }
+
+    inline void transform3_scalar(const f32 *m, const f32 *in, f32 *out, size_t n, transform_kind kind, bool)
+    {
+      if (kind == transform_kind::vector)
+        transform3_scalar_impl<transform_kind::vector>(m, in, out, n);
+      else if (kind == transform_kind::affine_point)
+        transform3_scalar_impl<transform_kind::affine_point>(m, in, out, n);
+      else if (kind == transform_kind::point)
+        transform3_scalar_impl<transform_kind::point>(m, in, out, n);
+      else
+        transform3_scalar_impl<transform_kind::normal>(m, in, out, n);
+    }
+
+#ifdef JW_MATH_X86
+    // four points per iteration, transposed to SoA in registers; same operation
+    // order as the scalar kernel so the tail matches bit for bit
+    template <transform_kind kind>
+    JW_MATH_TARGET("sse2") inline void transform3_sse2_impl(const f32 *m, const f32 *in, f32 *out, size_t n, bool stream)
+    {
+      __m128 c[16];
+      for (int j = 0; j < 16; j++)
+        c[j] = _mm_set1_ps(m[j]);
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 x, y, z;
+        deinterleave3_sse2(_mm_loadu_ps(in + 3 * i), _mm_loadu_ps(in + 3 * i + 4), _mm_loadu_ps(in + 3 * i + 8), x, y, z);
+        __m128 r[3];
+        for (int j = 0; j < 3; j++)
+        {
+          r[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[j], x), _mm_mul_ps(c[4 + j], y)), _mm_mul_ps(c[8 + j], z));
+          if (translates(kind))
+            r[j] = _mm_add_ps(r[j], c[12 + j]);
+        }
+        if (kind == transform_kind::point)
+        {
+          __m128 w = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[3], x), _mm_mul_ps(c[7], y)), _mm_mul_ps(c[11], z)), c[15]);
+          for (int j = 0; j < 3; j++)
+            r[j] = _mm_div_ps(r[j], w);
+        }
+        if (kind == transform_kind::normal)
+        {
+          __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r[0], r[0]), _mm_mul_ps(r[1], r[1])), _mm_mul_ps(r[2], r[2])));
+          for (int j = 0; j < 3; j++)
+            r[j] = _mm_div_ps(r[j], l);
+        }
+        __m128 a, b, d;
+        interleave3_sse2(r[0], r[1], r[2], a, b, d);
+        store_sse2(out + 3 * i, a, stream);
+        store_sse2(out + 3 * i + 4, b, stream);
+        store_sse2(out + 3 * i + 8, d, stream);
+      }
+      transform3_scalar_impl<kind>(m, in + 3 * i, out + 3 * i, n - i);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("sse2") inline void transform3_sse2(const f32 *m, const f32 *in, f32 *out, size_t n, transform_kind kind, bool stream)
+    {
+      if (kind == transform_kind::vector)
+        transform3_sse2_impl<transform_kind::vector>(m, in, out, n, stream);
+      else if (kind == transform_kind::affine_point)
+        transform3_sse2_impl<transform_kind::affine_point>(m, in, out, n, stream);
+      else if (kind == transform_kind::point)
+        transform3_sse2_impl<transform_kind::point>(m, in, out, n, stream);
+      else
+        transform3_sse2_impl<transform_kind::normal>(m, in, out, n, stream);
+    }
+
+    // eight points per iteration, see load_deinterleave3_avx
+    template <transform_kind kind>
+    JW_MATH_TARGET("avx2,fma") inline void transform3_avx2_impl(const f32 *m, const f32 *in, f32 *out, size_t n, bool stream)
+    {
+      __m256 c[16];
+      for (int j = 0; j < 16; j++)
+        c[j] = _mm256_set1_ps(m[j]);
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 x, y, z;
+        load_deinterleave3_avx(in + 3 * i, x, y, z);
+
+        __m256 r[3];
+        for (int j = 0; j < 3; j++)
+        {
+          __m256 t = translates(kind) ? _mm256_fmadd_ps(c[j], x, c[12 + j]) : _mm256_mul_ps(c[j], x);
+          r[j] = _mm256_fmadd_ps(c[8 + j], z, _mm256_fmadd_ps(c[4 + j], y, t));
+        }
+        if (kind == transform_kind::point)
+        {
+          __m256 w = _mm256_fmadd_ps(c[11], z, _mm256_fmadd_ps(c[7], y, _mm256_fmadd_ps(c[3], x, c[15])));
+          for (int j = 0; j < 3; j++)
+            r[j] = _mm256_div_ps(r[j], w);
+        }
+        if (kind == transform_kind::normal)
+        {
+          __m256 l = _mm256_sqrt_ps(_mm256_fmadd_ps(r[2], r[2], _mm256_fmadd_ps(r[1], r[1], _mm256_mul_ps(r[0], r[0]))));
+          for (int j = 0; j < 3; j++)
+            r[j] = _mm256_div_ps(r[j], l);
+        }
+
+        interleave3_store_avx(r[0], r[1], r[2], out + 3 * i, stream);
+      }
+      for (; i < n; i++)
+      {
+        f32 x = in[3 * i], y = in[3 * i + 1], z = in[3 * i + 2];
+        f32 r[3];
+        for (int j = 0; j < 3; j++)
+        {
+          f32 t = translates(kind) ? fmaf(m[j], x, m[12 + j]) : m[j] * x;
+          r[j] = fmaf(m[8 + j], z, fmaf(m[4 + j], y, t));
+        }
+        if (kind == transform_kind::point)
+        {
+          f32 w = fmaf(m[11], z, fmaf(m[7], y, fmaf(m[3], x, m[15])));
+          for (int j = 0; j < 3; j++)
+            r[j] = r[j] / w;
+        }
+        if (kind == transform_kind::normal)
+        {
+          f32 l = sqrtf(fmaf(r[2], r[2], fmaf(r[1], r[1], r[0] * r[0])));
+          for (int j = 0; j < 3; j++)
+            r[j] = r[j] / l;
+        }
+        memcpy(out + 3 * i, r, sizeof(r));
+      }
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("avx2,fma") inline void transform3_avx2(const f32 *m, const f32 *in, f32 *out, size_t n, transform_kind kind, bool stream)
+    {
+      if (kind == transform_kind::vector)
+        transform3_avx2_impl<transform_kind::vector>(m, in, out, n, stream);
+      else if (kind == transform_kind::affine_point)
+        transform3_avx2_impl<transform_kind::affine_point>(m, in, out, n, stream);
+      else if (kind == transform_kind::point)
+        transform3_avx2_impl<transform_kind::point>(m, in, out, n, stream);
+      else
+        transform3_avx2_impl<transform_kind::normal>(m, in, out, n, stream);
+    }
+#endif
+
+    // Determinants that are zero, subnormal or NaN count as singular, so that 1/det
+    // is always finite.
+    inline bool invertible_det(f32 det)
+    {
+      return fabsf(det) >= FLT_MIN;
+    }
+
+    // Writes the inverse-transpose of the upper-left 3x3 block of m into the same
+    // block of r (column stride 4). Returns false, leaving the cofactor matrix in r,
+    // when the block is singular.
+    inline bool inverse_transpose3(const f32 *m, f32 *r)
+    {
+      f32 c[9] = {
+          m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+          m[9] * m[2] - m[10] * m[1], m[10] * m[0] - m[8] * m[2], m[8] * m[1] - m[9] * m[0],
+          m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4]};
+      f32 det = m[0] * c[0] + m[1] * c[1] + m[2] * c[2];
+      bool invertible = invertible_det(det);
+      f32 s = invertible ? 1.0F / det : 1.0F;
+      for (int j = 0; j < 3; j++)
+        for (int i = 0; i < 3; i++)
+          r[4 * j + i] = c[3 * j + i] * s;
+      return invertible;
+    }
+
+    // true if the columns of the upper-left 3x3 block are orthogonal and of equal
+    // length, i.e. a rotation (or reflection) times a uniform scale
+    inline bool is_conformal3(const f32 *m, f32 tolerance = 1e-5F)
+    {
+      f32 l0 = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+      f32 l1 = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+      f32 l2 = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+      f32 d01 = m[0] * m[4] + m[1] * m[5] + m[2] * m[6];
+      f32 d02 = m[0] * m[8] + m[1] * m[9] + m[2] * m[10];
+      f32 d12 = m[4] * m[8] + m[5] * m[9] + m[6] * m[10];
+      f32 e = tolerance * l0;
+      return fabsf(l1 - l0) <= e && fabsf(l2 - l0) <= e && fabsf(d01) <= e && fabsf(d02) <= e && fabsf(d12) <= e;
+    }
+
+    // conformal with unit-length columns, i.e. a rotation or reflection
+    inline bool is_orthonormal3(const f32 *m, f32 tolerance = 1e-5F)
+    {
+      return is_conformal3(m, tolerance) && fabsf(m[0] * m[0] + m[1] * m[1] + m[2] * m[2] - 1.0F) <= tolerance;
+    }
+
+    // Instance pipeline: mvp[i] = vp * model[i] and, when mv or nrm is not null,
+    // mv[i] = v * model[i] and nrm[i] = the inverse-transpose of mv[i]'s 3x3 block
+    // (rest identity). Products match mat4_mul on the same path bit for bit, and the
+    // outputs may alias model.
+
+    inline void normal_matrix4(const f32 *m, f32 *r)
+    {
+      f32 t[16] = {0};
+      inverse_transpose3(m, t);
+      t[15] = 1.0F;
+      memcpy(r, t, sizeof(t));
+    }
+
+    inline void mvp_batch_scalar(const f32 *vp, const f32 *v, const f32 *model, f32 *mvp, f32 *mv, f32 *nrm, size_t n, bool)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        f32 b[16], t[16];
+        memcpy(b, model + 16 * i, sizeof(b));
+        mat4_mul_scalar(vp, b, mvp + 16 * i);
+        if (!mv && !nrm)
+          continue;
+        mat4_mul_scalar(v, b, t);
+        if (mv)
+          memcpy(mv + 16 * i, t, sizeof(t));
+        if (nrm)
+          normal_matrix4(t, nrm + 16 * i);
+      }
+    }
+
+#ifdef JW_MATH_X86
+    JW_MATH_TARGET("sse2") inline void mvp_batch_sse2(const f32 *vp, const f32 *v, const f32 *model, f32 *mvp, f32 *mv, f32 *nrm, size_t n, bool stream)
+    {
+      __m128 p[4], w[4];
+      for (int k = 0; k < 4; k++)
+      {
+        p[k] = _mm_loadu_ps(vp + 4 * k);
+        w[k] = v ? _mm_loadu_ps(v + 4 * k) : _mm_setzero_ps();
+      }
+      for (size_t i = 0; i < n; i++)
+      {
+        if (i + MAT4_PREFETCH_DISTANCE < n)
+          _mm_prefetch((const char *)(model + 16 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+        __m128 b[4], t[4];
+        for (int c = 0; c < 4; c++)
+          b[c] = _mm_loadu_ps(model + 16 * i + 4 * c);
+        for (int c = 0; c < 4; c++)
+          store_sse2(mvp + 16 * i + 4 * c, mat4_column_sse2(p, b[c]), stream);
+        if (!mv && !nrm)
+          continue;
+        for (int c = 0; c < 4; c++)
+          t[c] = mat4_column_sse2(w, b[c]);
+        if (mv)
+          for (int c = 0; c < 4; c++)
+            store_sse2(mv + 16 * i + 4 * c, t[c], stream);
+        if (nrm)
+        {
+          f32 m[16];
+          for (int c = 0; c < 4; c++)
+            _mm_storeu_ps(m + 4 * c, t[c]);
+          normal_matrix4(m, nrm + 16 * i);
+        }
+      }
+      stream_fence(stream);
+    }
+
+    // two columns per ymm as in mat4_mul_avx
+    JW_MATH_TARGET("avx,fma") inline void mvp_batch_avx(const f32 *vp, const f32 *v, const f32 *model, f32 *mvp, f32 *mv, f32 *nrm, size_t n, bool stream)
+    {
+      __m256 p[4], w[4];
+      for (int k = 0; k < 4; k++)
+      {
+        p[k] = load2_m128(vp + 4 * k, vp + 4 * k);
+        w[k] = v ? load2_m128(v + 4 * k, v + 4 * k) : _mm256_setzero_ps();
+      }
+      for (size_t i = 0; i < n; i++)
+      {
+        if (i + MAT4_PREFETCH_DISTANCE < n)
+          _mm_prefetch((const char *)(model + 16 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+        __m256 b0 = _mm256_loadu_ps(model + 16 * i), b1 = _mm256_loadu_ps(model + 16 * i + 8);
+        store2_m128(mvp + 16 * i, mat4_columns_avx(p, b0), stream);
+        store2_m128(mvp + 16 * i + 8, mat4_columns_avx(p, b1), stream);
+        if (!mv && !nrm)
+          continue;
+        __m256 t0 = mat4_columns_avx(w, b0), t1 = mat4_columns_avx(w, b1);
+        if (mv)
+        {
+          store2_m128(mv + 16 * i, t0, stream);
+          store2_m128(mv + 16 * i + 8, t1, stream);
+        }
+        if (nrm)
+        {
+          f32 m[16];
+          _mm256_storeu_ps(m, t0);
+          _mm256_storeu_ps(m + 8, t1);
+          normal_matrix4(m, nrm + 16 * i);
+        }
+      }
+      stream_fence(stream);
+    }
+#endif
+
+    // General 4x4 inverse. The kernels return the determinant and write the inverse
+    // to r (which may alias m), except when the matrix is singular: then r is left
+    // untouched and 0 is returned. A determinant that is zero, subnormal or NaN
+    // counts as singular, so 1/det is always finite. Inverting the transpose gives
+    // the transposed inverse, so the row-oriented formulas below serve column-major
+    // storage unchanged.
+
+    // cofactor expansion over the six 2x2 sub-determinants of the first two and the
+    // last two columns
+    inline f32 mat4_inverse_scalar(const f32 *m, f32 *r)
+    {
+      f32 s0 = m[0] * m[5] - m[4] * m[1], s1 = m[0] * m[6] - m[4] * m[2], s2 = m[0] * m[7] - m[4] * m[3];
+      f32 s3 = m[1] * m[6] - m[5] * m[2], s4 = m[1] * m[7] - m[5] * m[3], s5 = m[2] * m[7] - m[6] * m[3];
+      f32 c0 = m[8] * m[13] - m[12] * m[9], c1 = m[8] * m[14] - m[12] * m[10], c2 = m[8] * m[15] - m[12] * m[11];
+      f32 c3 = m[9] * m[14] - m[13] * m[10], c4 = m[9] * m[15] - m[13] * m[11], c5 = m[10] * m[15] - m[14] * m[11];
+      f32 det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+      if (!invertible_det(det))
+        return 0.0F;
+      f32 d = 1.0F / det, t[16] = {
+          (m[5] * c5 - m[6] * c4 + m[7] * c3) * d, (-m[1] * c5 + m[2] * c4 - m[3] * c3) * d,
+          (m[13] * s5 - m[14] * s4 + m[15] * s3) * d, (-m[9] * s5 + m[10] * s4 - m[11] * s3) * d,
+          (-m[4] * c5 + m[6] * c2 - m[7] * c1) * d, (m[0] * c5 - m[2] * c2 + m[3] * c1) * d,
+          (-m[12] * s5 + m[14] * s2 - m[15] * s1) * d, (m[8] * s5 - m[10] * s2 + m[11] * s1) * d,
+          (m[4] * c4 - m[5] * c2 + m[7] * c0) * d, (-m[0] * c4 + m[1] * c2 - m[3] * c0) * d,
+          (m[12] * s4 - m[13] * s2 + m[15] * s0) * d, (-m[8] * s4 + m[9] * s2 - m[11] * s0) * d,
+          (-m[4] * c3 + m[5] * c1 - m[6] * c0) * d, (m[0] * c3 - m[1] * c1 + m[2] * c0) * d,
+          (-m[12] * s3 + m[13] * s1 - m[14] * s0) * d, (m[8] * s3 - m[9] * s1 + m[10] * s0) * d};
+      memcpy(r, t, sizeof(t));
+      return det;
+    }
+
+    // Each batch entry gets the kernel's result: det[i] (if det is not null) receives
+    // the determinant, and a singular matrix is copied to r unchanged. Returns the
+    // number of singular matrices.
+    inline size_t mat4_inverse_batch_scalar(const f32 *m, f32 *r, f32 *det, size_t n)
+    {
+      size_t singular = 0;
+      for (size_t i = 0; i < n; i++)
+      {
+        f32 d = mat4_inverse_scalar(m + 16 * i, r + 16 * i);
+        if (d == 0)
+        {
+          singular++;
+          if (r != m)
+            memcpy(r + 16 * i, m + 16 * i, 16 * sizeof(f32));
+        }
+        if (det)
+          det[i] = d;
+      }
+      return singular;
+    }
+
+    // Inverse of an affine matrix, whose last row is taken to be (0, 0, 0, 1): the
+    // 3x3 block is inverted through its cofactors and the translation transformed
+    // back by it. Returns the 3x3 determinant, with the same singularity handling
+    // as mat4_inverse.
+    inline f32 mat4_inverse_affine(const f32 *m, f32 *r)
+    {
+      f32 c[9] = {
+          m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+          m[9] * m[2] - m[10] * m[1], m[10] * m[0] - m[8] * m[2], m[8] * m[1] - m[9] * m[0],
+          m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4]};
+      f32 det = m[0] * c[0] + m[1] * c[1] + m[2] * c[2];
+      if (!invertible_det(det))
+        return 0.0F;
+      f32 d = 1.0F / det, t[16] = {0};
+      for (int j = 0; j < 3; j++)
+        for (int i = 0; i < 3; i++)
+          t[4 * i + j] = c[3 * j + i] * d;
+      for (int i = 0; i < 3; i++)
+        t[12 + i] = -(t[i] * m[12] + t[4 + i] * m[13] + t[8 + i] * m[14]);
+      t[15] = 1.0F;
+      memcpy(r, t, sizeof(t));
+      return det;
+    }
+
+    // rigid (orthonormal 3x3 block): the block is transposed instead of inverted
+    inline void mat4_inverse_rigid(const f32 *m, f32 *r)
+    {
+      f32 t[16] = {
+          m[0], m[4], m[8], 0.0F,
+          m[1], m[5], m[9], 0.0F,
+          m[2], m[6], m[10], 0.0F,
+          0.0F, 0.0F, 0.0F, 1.0F};
+      for (int i = 0; i < 3; i++)
+        t[12 + i] = -(t[i] * m[12] + t[4 + i] * m[13] + t[8 + i] * m[14]);
+      memcpy(r, t, sizeof(t));
+    }
+
+#ifdef JW_MATH_X86
+    // Block-wise inverse: with M = [A B; C D] split into 2x2 blocks, each block of
+    // the adjugate is |D|A - B adj(D)C and so on, and |M| = |A||D| + |B||C| -
+    // tr(adj(A)B adj(D)C). 2x2 blocks are held as (m00, m01, m10, m11). The AVX
+    // batch runs the same operations on two matrices at once, so both paths agree
+    // bit for bit.
+
+    template <int x, int y, int z, int w>
+    JW_MATH_TARGET("sse2") inline __m128 swizzle_sse2(__m128 v)
+    {
+      return _mm_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x));
+    }
+
+    // a * b, adj(a) * b and a * adj(b)
+    JW_MATH_TARGET("sse2") inline __m128 mat2_mul_sse2(__m128 a, __m128 b)
+    {
+      return _mm_add_ps(_mm_mul_ps(a, swizzle_sse2<0, 3, 0, 3>(b)), _mm_mul_ps(swizzle_sse2<1, 0, 3, 2>(a), swizzle_sse2<2, 1, 2, 1>(b)));
+    }
+
+    JW_MATH_TARGET("sse2") inline __m128 mat2_adj_mul_sse2(__m128 a, __m128 b)
+    {
+      return _mm_sub_ps(_mm_mul_ps(swizzle_sse2<3, 3, 0, 0>(a), b), _mm_mul_ps(swizzle_sse2<1, 1, 2, 2>(a), swizzle_sse2<2, 3, 0, 1>(b)));
+    }
+
+    JW_MATH_TARGET("sse2") inline __m128 mat2_mul_adj_sse2(__m128 a, __m128 b)
+    {
+      return _mm_sub_ps(_mm_mul_ps(a, swizzle_sse2<3, 0, 3, 0>(b)), _mm_mul_ps(swizzle_sse2<1, 0, 3, 2>(a), swizzle_sse2<2, 1, 2, 1>(b)));
+    }
+
+    JW_MATH_TARGET("sse2") inline f32 mat4_inverse_sse2(const f32 *m, f32 *r)
+    {
+      __m128 m0 = _mm_loadu_ps(m), m1 = _mm_loadu_ps(m + 4), m2 = _mm_loadu_ps(m + 8), m3 = _mm_loadu_ps(m + 12);
+      __m128 a = _mm_movelh_ps(m0, m1), b = _mm_movehl_ps(m1, m0), c = _mm_movelh_ps(m2, m3), d = _mm_movehl_ps(m3, m2);
+      // (|A|, |B|, |C|, |D|)
+      __m128 dets = _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(m0, m2, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(m1, m3, _MM_SHUFFLE(3, 1, 3, 1))),
+                               _mm_mul_ps(_mm_shuffle_ps(m0, m2, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(m1, m3, _MM_SHUFFLE(2, 0, 2, 0))));
+      __m128 det_a = swizzle_sse2<0, 0, 0, 0>(dets), det_b = swizzle_sse2<1, 1, 1, 1>(dets);
+      __m128 det_c = swizzle_sse2<2, 2, 2, 2>(dets), det_d = swizzle_sse2<3, 3, 3, 3>(dets);
+      __m128 dc = mat2_adj_mul_sse2(d, c), ab = mat2_adj_mul_sse2(a, b);
+      __m128 x = _mm_sub_ps(_mm_mul_ps(det_d, a), mat2_mul_sse2(b, dc));
+      __m128 w = _mm_sub_ps(_mm_mul_ps(det_a, d), mat2_mul_sse2(c, ab));
+      __m128 y = _mm_sub_ps(_mm_mul_ps(det_b, c), mat2_mul_adj_sse2(d, ab));
+      __m128 z = _mm_sub_ps(_mm_mul_ps(det_c, b), mat2_mul_adj_sse2(a, dc));
+      __m128 tr = _mm_mul_ps(ab, swizzle_sse2<0, 2, 1, 3>(dc));
+      tr = _mm_add_ps(tr, swizzle_sse2<1, 0, 3, 2>(tr));
+      tr = _mm_add_ps(tr, swizzle_sse2<2, 3, 0, 1>(tr));
+      __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+      f32 result = _mm_cvtss_f32(det);
+      if (!invertible_det(result))
+        return 0.0F;
+      __m128 s = _mm_div_ps(_mm_setr_ps(1.0F, -1.0F, -1.0F, 1.0F), det);
+      x = _mm_mul_ps(x, s);
+      y = _mm_mul_ps(y, s);
+      z = _mm_mul_ps(z, s);
+      w = _mm_mul_ps(w, s);
+      _mm_storeu_ps(r, _mm_shuffle_ps(x, y, _MM_SHUFFLE(1, 3, 1, 3)));
+      _mm_storeu_ps(r + 4, _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 2, 0, 2)));
+      _mm_storeu_ps(r + 8, _mm_shuffle_ps(z, w, _MM_SHUFFLE(1, 3, 1, 3)));
+      _mm_storeu_ps(r + 12, _mm_shuffle_ps(z, w, _MM_SHUFFLE(0, 2, 0, 2)));
+      return result;
+    }
+
+    JW_MATH_TARGET("sse2") inline size_t mat4_inverse_batch_sse2(const f32 *m, f32 *r, f32 *det, size_t n)
+    {
+      size_t singular = 0;
+      for (size_t i = 0; i < n; i++)
+      {
+        if (i + MAT4_PREFETCH_DISTANCE < n)
+          _mm_prefetch((const char *)(m + 16 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+        f32 d = mat4_inverse_sse2(m + 16 * i, r + 16 * i);
+        if (d == 0)
+        {
+          singular++;
+          if (r != m)
+            memcpy(r + 16 * i, m + 16 * i, 16 * sizeof(f32));
+        }
+        if (det)
+          det[i] = d;
+      }
+      return singular;
+    }
+
+    template <int x, int y, int z, int w>
+    JW_MATH_TARGET("avx") inline __m256 swizzle_avx(__m256 v)
+    {
+      return _mm256_permute_ps(v, _MM_SHUFFLE(w, z, y, x));
+    }
+
+    JW_MATH_TARGET("avx") inline __m256 mat2_mul_avx(__m256 a, __m256 b)
+    {
+      return _mm256_add_ps(_mm256_mul_ps(a, swizzle_avx<0, 3, 0, 3>(b)), _mm256_mul_ps(swizzle_avx<1, 0, 3, 2>(a), swizzle_avx<2, 1, 2, 1>(b)));
+    }
+
+    JW_MATH_TARGET("avx") inline __m256 mat2_adj_mul_avx(__m256 a, __m256 b)
+    {
+      return _mm256_sub_ps(_mm256_mul_ps(swizzle_avx<3, 3, 0, 0>(a), b), _mm256_mul_ps(swizzle_avx<1, 1, 2, 2>(a), swizzle_avx<2, 3, 0, 1>(b)));
+    }
+
+    JW_MATH_TARGET("avx") inline __m256 mat2_mul_adj_avx(__m256 a, __m256 b)
+    {
+      return _mm256_sub_ps(_mm256_mul_ps(a, swizzle_avx<3, 0, 3, 0>(b)), _mm256_mul_ps(swizzle_avx<1, 0, 3, 2>(a), swizzle_avx<2, 1, 2, 1>(b)));
+    }
+
+    // matrix i in the low lanes and i + 1 in the high lanes
+    JW_MATH_TARGET("avx") inline size_t mat4_inverse_batch_avx(const f32 *m, f32 *r, f32 *det, size_t n)
+    {
+      size_t singular = 0, i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        if (i + MAT4_PREFETCH_DISTANCE + 1 < n)
+          _mm_prefetch((const char *)(m + 16 * (i + MAT4_PREFETCH_DISTANCE + 1)), _MM_HINT_T0);
+        const f32 *p = m + 16 * i;
+        __m256 m0 = load2_m128(p, p + 16), m1 = load2_m128(p + 4, p + 20);
+        __m256 m2 = load2_m128(p + 8, p + 24), m3 = load2_m128(p + 12, p + 28);
+        __m256 a = _mm256_shuffle_ps(m0, m1, _MM_SHUFFLE(1, 0, 1, 0)), b = _mm256_shuffle_ps(m0, m1, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 c = _mm256_shuffle_ps(m2, m3, _MM_SHUFFLE(1, 0, 1, 0)), d = _mm256_shuffle_ps(m2, m3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 dets = _mm256_sub_ps(_mm256_mul_ps(_mm256_shuffle_ps(m0, m2, _MM_SHUFFLE(2, 0, 2, 0)), _mm256_shuffle_ps(m1, m3, _MM_SHUFFLE(3, 1, 3, 1))),
+                                    _mm256_mul_ps(_mm256_shuffle_ps(m0, m2, _MM_SHUFFLE(3, 1, 3, 1)), _mm256_shuffle_ps(m1, m3, _MM_SHUFFLE(2, 0, 2, 0))));
+        __m256 det_a = swizzle_avx<0, 0, 0, 0>(dets), det_b = swizzle_avx<1, 1, 1, 1>(dets);
+        __m256 det_c = swizzle_avx<2, 2, 2, 2>(dets), det_d = swizzle_avx<3, 3, 3, 3>(dets);
+        __m256 dc = mat2_adj_mul_avx(d, c), ab = mat2_adj_mul_avx(a, b);
+        __m256 x = _mm256_sub_ps(_mm256_mul_ps(det_d, a), mat2_mul_avx(b, dc));
+        __m256 w = _mm256_sub_ps(_mm256_mul_ps(det_a, d), mat2_mul_avx(c, ab));
+        __m256 y = _mm256_sub_ps(_mm256_mul_ps(det_b, c), mat2_mul_adj_avx(d, ab));
+        __m256 z = _mm256_sub_ps(_mm256_mul_ps(det_c, b), mat2_mul_adj_avx(a, dc));
+        __m256 tr = _mm256_mul_ps(ab, swizzle_avx<0, 2, 1, 3>(dc));
+        tr = _mm256_add_ps(tr, swizzle_avx<1, 0, 3, 2>(tr));
+        tr = _mm256_add_ps(tr, swizzle_avx<2, 3, 0, 1>(tr));
+        __m256 dm = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(det_a, det_d), _mm256_mul_ps(det_b, det_c)), tr);
+        __m256 s = _mm256_div_ps(_mm256_setr_ps(1.0F, -1.0F, -1.0F, 1.0F, 1.0F, -1.0F, -1.0F, 1.0F), dm);
+        x = _mm256_mul_ps(x, s);
+        y = _mm256_mul_ps(y, s);
+        z = _mm256_mul_ps(z, s);
+        w = _mm256_mul_ps(w, s);
+        __m256 r0 = _mm256_shuffle_ps(x, y, _MM_SHUFFLE(1, 3, 1, 3)), r1 = _mm256_shuffle_ps(x, y, _MM_SHUFFLE(0, 2, 0, 2));
+        __m256 r2 = _mm256_shuffle_ps(z, w, _MM_SHUFFLE(1, 3, 1, 3)), r3 = _mm256_shuffle_ps(z, w, _MM_SHUFFLE(0, 2, 0, 2));
+        f32 ds[8];
+        _mm256_storeu_ps(ds, dm);
+        for (int h = 0; h < 2; h++)
+        {
+          f32 *q = r + 16 * (i + h);
+          f32 dh = invertible_det(ds[4 * h]) ? ds[4 * h] : 0.0F;
+          if (dh != 0)
+          {
+            _mm_storeu_ps(q, h ? _mm256_extractf128_ps(r0, 1) : _mm256_castps256_ps128(r0));
+            _mm_storeu_ps(q + 4, h ? _mm256_extractf128_ps(r1, 1) : _mm256_castps256_ps128(r1));
+            _mm_storeu_ps(q + 8, h ? _mm256_extractf128_ps(r2, 1) : _mm256_castps256_ps128(r2));
+            _mm_storeu_ps(q + 12, h ? _mm256_extractf128_ps(r3, 1) : _mm256_castps256_ps128(r3));
+          }
+          else
+          {
+            singular++;
+            if (r != m)
+              memcpy(q, p + 16 * h, 16 * sizeof(f32));
+          }
+          if (det)
+            det[i + h] = dh;
+        }
+      }
+      return singular + mat4_inverse_batch_sse2(m + 16 * i, r + 16 * i, det ? det + i : nullptr, n - i);
+    }
+#endif
+
+    // affine3 products: 4 columns of 3 floats, the last one the translation, with an
+    // implied bottom row of (0, 0, 0, 1). r may alias a or b. The operation order is
+    // that of mat4_mul_scalar with the constant row dropped, so every path matches
+    // it (and the non-FMA mat4 products) bit for bit.
+    inline void affine3_mul_scalar(const f32 *a, const f32 *b, f32 *r)
+    {
+      f32 t[12];
+      for (int c = 0; c < 12; c += 3)
+        for (int i = 0; i < 3; i++)
+          t[c + i] = a[i] * b[c] + a[3 + i] * b[c + 1] + a[6 + i] * b[c + 2];
+      for (int i = 0; i < 3; i++)
+        t[9 + i] += a[9 + i];
+      memcpy(r, t, sizeof(t));
+    }
+
+    inline void affine3_mul_batch_scalar(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+        affine3_mul_scalar(a + 12 * i, b + 12 * i, r + 12 * i);
+    }
+
+#ifdef JW_MATH_X86
+    // Loads the four columns into the low three lanes of c without reading past
+    // the 12 floats; lane 3 holds junk.
+    JW_MATH_TARGET("sse2") inline void affine3_load_sse2(const f32 *m, __m128 c[4])
+    {
+      c[0] = _mm_loadu_ps(m);
+      c[1] = _mm_loadu_ps(m + 3);
+      c[2] = _mm_loadu_ps(m + 6);
+      __m128 t = _mm_loadu_ps(m + 8);
+      c[3] = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 3, 2, 1));
+    }
+
+    JW_MATH_TARGET("sse2") inline void affine3_store_sse2(f32 *m, const __m128 c[4])
+    {
+      __m128 t0 = _mm_shuffle_ps(c[0], c[1], _MM_SHUFFLE(0, 0, 2, 2));
+      __m128 t2 = _mm_shuffle_ps(c[2], c[3], _MM_SHUFFLE(0, 0, 2, 2));
+      _mm_storeu_ps(m, _mm_shuffle_ps(c[0], t0, _MM_SHUFFLE(2, 0, 1, 0)));
+      _mm_storeu_ps(m + 4, _mm_shuffle_ps(c[1], c[2], _MM_SHUFFLE(1, 0, 2, 1)));
+      _mm_storeu_ps(m + 8, _mm_shuffle_ps(t2, c[3], _MM_SHUFFLE(2, 1, 2, 0)));
+    }
+
+    JW_MATH_TARGET("sse2") inline void affine3_mul_sse2(const f32 *a, const f32 *b, f32 *r)
+    {
+      __m128 ac[4], bc[4];
+      affine3_load_sse2(a, ac);
+      affine3_load_sse2(b, bc);
+      for (int c = 0; c < 3; c++)
+        bc[c] = mat4_column3_sse2(ac, bc[c]);
+      bc[3] = _mm_add_ps(mat4_column3_sse2(ac, bc[3]), ac[3]);
+      affine3_store_sse2(r, bc);
+    }
+
+    JW_MATH_TARGET("sse2") inline void affine3_mul_batch_sse2(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        if (i + MAT4_PREFETCH_DISTANCE < n)
+        {
+          _mm_prefetch((const char *)(a + 12 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+          _mm_prefetch((const char *)(b + 12 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+        }
+        affine3_mul_sse2(a + 12 * i, b + 12 * i, r + 12 * i);
+      }
+    }
+#endif
+
+    // mat3 kernels: three column-major columns of three floats. Products follow
+    // mat4_mul_scalar's operation order on every path, and outputs may alias the
+    // inputs.
+    inline void mat3_mul_scalar(const f32 *a, const f32 *b, f32 *r)
+    {
+      f32 t[9];
+      for (int c = 0; c < 9; c += 3)
+        for (int i = 0; i < 3; i++)
+          t[c + i] = a[i] * b[c] + a[3 + i] * b[c + 1] + a[6 + i] * b[c + 2];
+      memcpy(r, t, sizeof(t));
+    }
+
+    inline void mat3_mul_batch_scalar(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+        mat3_mul_scalar(a + 9 * i, b + 9 * i, r + 9 * i);
+    }
+
+    // The cofactors, i.e. the cross products of the columns, and the determinant
+    // expanded along the first column; mat3::determinant uses it so that it
+    // returns exactly what mat3_inverse does.
+    inline f32 mat3_cofactors(const f32 *m, f32 c[9])
+    {
+      c[0] = m[4] * m[8] - m[5] * m[7], c[1] = m[5] * m[6] - m[3] * m[8], c[2] = m[3] * m[7] - m[4] * m[6];
+      c[3] = m[7] * m[2] - m[8] * m[1], c[4] = m[8] * m[0] - m[6] * m[2], c[5] = m[6] * m[1] - m[7] * m[0];
+      c[6] = m[1] * m[5] - m[2] * m[4], c[7] = m[2] * m[3] - m[0] * m[5], c[8] = m[0] * m[4] - m[1] * m[3];
+      return m[0] * c[0] + m[1] * c[1] + m[2] * c[2];
+    }
+
+    // Inverse through the cofactors with the singularity handling of mat4_inverse.
+    inline f32 mat3_inverse(const f32 *m, f32 *r)
+    {
+      f32 c[9];
+      f32 det = mat3_cofactors(m, c);
+      if (!invertible_det(det))
+        return 0.0F;
+      f32 d = 1.0F / det;
+      for (int j = 0; j < 3; j++)
+        for (int i = 0; i < 3; i++)
+          r[3 * i + j] = c[3 * j + i] * d;
+      return det;
+    }
+
+    // Normal matrices of mat4s: r[i] = the inverse-transpose of the upper-left 3x3
+    // block of m[i] as a mat3, or its cofactor matrix when singular, as in
+    // normal_matrix4.
+    inline void normal_matrix3_batch_scalar(const f32 *m, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        f32 t[16];
+        inverse_transpose3(m + 16 * i, t);
+        for (int c = 0; c < 3; c++)
+          memcpy(r + 9 * i + 3 * c, t + 4 * c, 3 * sizeof(f32));
+      }
+    }
+
+#ifdef JW_MATH_X86
+    // Loads the three columns into the low three lanes of c without reading past
+    // the 9 floats; lane 3 holds junk.
+    JW_MATH_TARGET("sse2") inline void mat3_load_sse2(const f32 *m, __m128 c[3])
+    {
+      c[0] = _mm_loadu_ps(m);
+      c[1] = _mm_loadu_ps(m + 3);
+      __m128 t = _mm_loadu_ps(m + 5);
+      c[2] = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 3, 2, 1));
+    }
+
+    JW_MATH_TARGET("sse2") inline void mat3_store_sse2(f32 *m, const __m128 c[3])
+    {
+      __m128 t0 = _mm_shuffle_ps(c[0], c[1], _MM_SHUFFLE(0, 0, 2, 2));
+      _mm_storeu_ps(m, _mm_shuffle_ps(c[0], t0, _MM_SHUFFLE(2, 0, 1, 0)));
+      _mm_storeu_ps(m + 4, _mm_shuffle_ps(c[1], c[2], _MM_SHUFFLE(1, 0, 2, 1)));
+      _mm_store_ss(m + 8, _mm_movehl_ps(c[2], c[2]));
+    }
+
+    JW_MATH_TARGET("sse2") inline void mat3_mul_sse2(const f32 *a, const f32 *b, f32 *r)
+    {
+      __m128 ac[3], bc[3];
+      mat3_load_sse2(a, ac);
+      mat3_load_sse2(b, bc);
+      for (int c = 0; c < 3; c++)
+        bc[c] = mat4_column3_sse2(ac, bc[c]);
+      mat3_store_sse2(r, bc);
+    }
+
+    JW_MATH_TARGET("sse2") inline void mat3_mul_batch_sse2(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        if (i + MAT4_PREFETCH_DISTANCE < n)
+        {
+          _mm_prefetch((const char *)(a + 9 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+          _mm_prefetch((const char *)(b + 9 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+        }
+        mat3_mul_sse2(a + 9 * i, b + 9 * i, r + 9 * i);
+      }
+    }
+
+    // a x b in the low three lanes, in inverse_transpose3's operation order
+    JW_MATH_TARGET("sse2") inline __m128 cross3_sse2(__m128 a, __m128 b)
+    {
+      return _mm_sub_ps(_mm_mul_ps(swizzle_sse2<1, 2, 0, 3>(a), swizzle_sse2<2, 0, 1, 3>(b)),
+                        _mm_mul_ps(swizzle_sse2<2, 0, 1, 3>(a), swizzle_sse2<1, 2, 0, 3>(b)));
+    }
+
+    // the columns of the cofactor matrix are the cross products of the columns
+    JW_MATH_TARGET("sse2") inline void normal_matrix3_batch_sse2(const f32 *m, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        if (i + MAT4_PREFETCH_DISTANCE < n)
+          _mm_prefetch((const char *)(m + 16 * (i + MAT4_PREFETCH_DISTANCE)), _MM_HINT_T0);
+        __m128 c0 = _mm_loadu_ps(m + 16 * i), c1 = _mm_loadu_ps(m + 16 * i + 4), c2 = _mm_loadu_ps(m + 16 * i + 8);
+        __m128 x[3] = {cross3_sse2(c1, c2), cross3_sse2(c2, c0), cross3_sse2(c0, c1)};
+        __m128 t = _mm_mul_ps(c0, x[0]);
+        f32 det = _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(t, swizzle_sse2<1, 1, 1, 1>(t)), _mm_movehl_ps(t, t)));
+        __m128 s = _mm_set1_ps(invertible_det(det) ? 1.0F / det : 1.0F);
+        for (int c = 0; c < 3; c++)
+          x[c] = _mm_mul_ps(x[c], s);
+        mat3_store_sse2(r + 9 * i, x);
+      }
+    }
+#endif
+
+    // Kernels over SoA streams. a[k], b[k] and r[k] point at component k of n
+    // elements, and dim is the number of components (2 to 4). Outputs may alias the
+    // inputs. Every path uses the same operation order, without FMA, so the results
+    // do not depend on the ISA.
+
+    inline void soa_add_scalar(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+        r[i] = a[i] + b[i];
+    }
+
+    inline void soa_sub_scalar(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+        r[i] = a[i] - b[i];
+    }
+
+    inline void soa_scale_scalar(const f32 *a, f32 s, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+        r[i] = a[i] * s;
+    }
+
+    inline void soa_lerp_scalar(const f32 *a, const f32 *b, f32 t, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+        r[i] = a[i] + (b[i] - a[i]) * t;
+    }
+
+    inline void soa_dot_scalar(const f32 *const a[4], const f32 *const b[4], int dim, f32 *r, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        f32 d = a[0][i] * b[0][i];
+        for (int k = 1; k < dim; k++)
+          d = d + a[k][i] * b[k][i];
+        r[i] = d;
+      }
+    }
+
+    inline void soa_length_scalar(const f32 *const a[4], int dim, f32 *r, size_t n)
+    {
+      soa_dot_scalar(a, a, dim, r, n);
+      for (size_t i = 0; i < n; i++)
+        r[i] = sqrtf(r[i]);
+    }
+
+    inline void soa_normalize_scalar(f32 *const a[4], int dim, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        f32 d = a[0][i] * a[0][i];
+        for (int k = 1; k < dim; k++)
+          d = d + a[k][i] * a[k][i];
+        f32 l = sqrtf(d);
+        for (int k = 0; k < dim; k++)
+          a[k][i] = a[k][i] / l;
+      }
+    }
+
+    inline void soa_cross_scalar(const f32 *const a[3], const f32 *const b[3], f32 *const r[3], size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        f32 x = a[1][i] * b[2][i] - a[2][i] * b[1][i];
+        f32 y = a[2][i] * b[0][i] - a[0][i] * b[2][i];
+        f32 z = a[0][i] * b[1][i] - a[1][i] * b[0][i];
+        r[0][i] = x;
+        r[1][i] = y;
+        r[2][i] = z;
+      }
+    }
+
+#ifdef JW_MATH_X86
+    JW_MATH_TARGET("sse2") inline void soa_add_sse2(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(r + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+      soa_add_scalar(a + i, b + i, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_sub_sse2(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(r + i, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+      soa_sub_scalar(a + i, b + i, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_scale_sse2(const f32 *a, f32 s, f32 *r, size_t n)
+    {
+      __m128 sv = _mm_set1_ps(s);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(r + i, _mm_mul_ps(_mm_loadu_ps(a + i), sv));
+      soa_scale_scalar(a + i, s, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_lerp_sse2(const f32 *a, const f32 *b, f32 t, f32 *r, size_t n)
+    {
+      __m128 tv = _mm_set1_ps(t);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 av = _mm_loadu_ps(a + i);
+        _mm_storeu_ps(r + i, _mm_add_ps(av, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b + i), av), tv)));
+      }
+      soa_lerp_scalar(a + i, b + i, t, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline __m128 soa_dot4_sse2(const f32 *const a[4], const f32 *const b[4], int dim, size_t i)
+    {
+      __m128 d = _mm_mul_ps(_mm_loadu_ps(a[0] + i), _mm_loadu_ps(b[0] + i));
+      for (int k = 1; k < dim; k++)
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(a[k] + i), _mm_loadu_ps(b[k] + i)));
+      return d;
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_dot_sse2(const f32 *const a[4], const f32 *const b[4], int dim, f32 *r, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(r + i, soa_dot4_sse2(a, b, dim, i));
+      const f32 *at[4] = {a[0] + i, a[1] + i, dim > 2 ? a[2] + i : nullptr, dim > 3 ? a[3] + i : nullptr};
+      const f32 *bt[4] = {b[0] + i, b[1] + i, dim > 2 ? b[2] + i : nullptr, dim > 3 ? b[3] + i : nullptr};
+      soa_dot_scalar(at, bt, dim, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_length_sse2(const f32 *const a[4], int dim, f32 *r, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(r + i, _mm_sqrt_ps(soa_dot4_sse2(a, a, dim, i)));
+      const f32 *at[4] = {a[0] + i, a[1] + i, dim > 2 ? a[2] + i : nullptr, dim > 3 ? a[3] + i : nullptr};
+      soa_length_scalar(at, dim, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_normalize_sse2(f32 *const a[4], int dim, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 l = _mm_sqrt_ps(soa_dot4_sse2(a, a, dim, i));
+        for (int k = 0; k < dim; k++)
+          _mm_storeu_ps(a[k] + i, _mm_div_ps(_mm_loadu_ps(a[k] + i), l));
+      }
+      f32 *at[4] = {a[0] + i, a[1] + i, dim > 2 ? a[2] + i : nullptr, dim > 3 ? a[3] + i : nullptr};
+      soa_normalize_scalar(at, dim, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_cross_sse2(const f32 *const a[3], const f32 *const b[3], f32 *const r[3], size_t n)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 ax = _mm_loadu_ps(a[0] + i), ay = _mm_loadu_ps(a[1] + i), az = _mm_loadu_ps(a[2] + i);
+        __m128 bx = _mm_loadu_ps(b[0] + i), by = _mm_loadu_ps(b[1] + i), bz = _mm_loadu_ps(b[2] + i);
+        _mm_storeu_ps(r[0] + i, _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by)));
+        _mm_storeu_ps(r[1] + i, _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz)));
+        _mm_storeu_ps(r[2] + i, _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx)));
+      }
+      const f32 *at[3] = {a[0] + i, a[1] + i, a[2] + i};
+      const f32 *bt[3] = {b[0] + i, b[1] + i, b[2] + i};
+      f32 *rt[3] = {r[0] + i, r[1] + i, r[2] + i};
+      soa_cross_scalar(at, bt, rt, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_add_avx(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(r + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+      soa_add_scalar(a + i, b + i, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_sub_avx(const f32 *a, const f32 *b, f32 *r, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(r + i, _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+      soa_sub_scalar(a + i, b + i, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_scale_avx(const f32 *a, f32 s, f32 *r, size_t n)
+    {
+      __m256 sv = _mm256_set1_ps(s);
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(r + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), sv));
+      soa_scale_scalar(a + i, s, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_lerp_avx(const f32 *a, const f32 *b, f32 t, f32 *r, size_t n)
+    {
+      __m256 tv = _mm256_set1_ps(t);
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 av = _mm256_loadu_ps(a + i);
+        _mm256_storeu_ps(r + i, _mm256_add_ps(av, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(b + i), av), tv)));
+      }
+      soa_lerp_scalar(a + i, b + i, t, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline __m256 soa_dot8_avx(const f32 *const a[4], const f32 *const b[4], int dim, size_t i)
+    {
+      __m256 d = _mm256_mul_ps(_mm256_loadu_ps(a[0] + i), _mm256_loadu_ps(b[0] + i));
+      for (int k = 1; k < dim; k++)
+        d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_loadu_ps(a[k] + i), _mm256_loadu_ps(b[k] + i)));
+      return d;
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_dot_avx(const f32 *const a[4], const f32 *const b[4], int dim, f32 *r, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(r + i, soa_dot8_avx(a, b, dim, i));
+      const f32 *at[4] = {a[0] + i, a[1] + i, dim > 2 ? a[2] + i : nullptr, dim > 3 ? a[3] + i : nullptr};
+      const f32 *bt[4] = {b[0] + i, b[1] + i, dim > 2 ? b[2] + i : nullptr, dim > 3 ? b[3] + i : nullptr};
+      soa_dot_scalar(at, bt, dim, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_length_avx(const f32 *const a[4], int dim, f32 *r, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(r + i, _mm256_sqrt_ps(soa_dot8_avx(a, a, dim, i)));
+      const f32 *at[4] = {a[0] + i, a[1] + i, dim > 2 ? a[2] + i : nullptr, dim > 3 ? a[3] + i : nullptr};
+      soa_length_scalar(at, dim, r + i, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_normalize_avx(f32 *const a[4], int dim, size_t n)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 l = _mm256_sqrt_ps(soa_dot8_avx(a, a, dim, i));
+        for (int k = 0; k < dim; k++)
+          _mm256_storeu_ps(a[k] + i, _mm256_div_ps(_mm256_loadu_ps(a[k] + i), l));
+      }
+      f32 *at[4] = {a[0] + i, a[1] + i, dim > 2 ? a[2] + i : nullptr, dim > 3 ? a[3] + i : nullptr};
+      soa_normalize_scalar(at, dim, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_cross_avx(const f32 *const a[3], const f32 *const b[3], f32 *const r[3], size_t n)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 ax = _mm256_loadu_ps(a[0] + i), ay = _mm256_loadu_ps(a[1] + i), az = _mm256_loadu_ps(a[2] + i);
+        __m256 bx = _mm256_loadu_ps(b[0] + i), by = _mm256_loadu_ps(b[1] + i), bz = _mm256_loadu_ps(b[2] + i);
+        _mm256_storeu_ps(r[0] + i, _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by)));
+        _mm256_storeu_ps(r[1] + i, _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(ax, bz)));
+        _mm256_storeu_ps(r[2] + i, _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx)));
+      }
+      const f32 *at[3] = {a[0] + i, a[1] + i, a[2] + i};
+      const f32 *bt[3] = {b[0] + i, b[1] + i, b[2] + i};
+      f32 *rt[3] = {r[0] + i, r[1] + i, r[2] + i};
+      soa_cross_scalar(at, bt, rt, n - i);
+    }
+#endif
+
+    // AoS <-> SoA conversion of tightly packed vec3 or vec4 arrays, with soa[k]
+    // pointing at component k.
+
+    template <int dim>
+    inline void aos_to_soa_scalar(const f32 *aos, f32 *const soa[4], size_t n, bool)
+    {
+      for (size_t i = 0; i < n; i++)
+        for (int k = 0; k < dim; k++)
+          soa[k][i] = aos[dim * i + k];
+    }
+
+    template <int dim>
+    inline void soa_to_aos_scalar(const f32 *const soa[4], f32 *aos, size_t n, bool)
+    {
+      for (size_t i = 0; i < n; i++)
+        for (int k = 0; k < dim; k++)
+          aos[dim * i + k] = soa[k][i];
+    }
+
+    template <int dim>
+    inline void aos_to_soa_tail(const f32 *aos, f32 *const soa[4], size_t i, size_t n)
+    {
+      f32 *t[4] = {soa[0] + i, soa[1] + i, soa[2] + i, dim > 3 ? soa[3] + i : nullptr};
+      aos_to_soa_scalar<dim>(aos + dim * i, t, n - i, false);
+    }
+
+    template <int dim>
+    inline void soa_to_aos_tail(const f32 *const soa[4], f32 *aos, size_t i, size_t n)
+    {
+      const f32 *t[4] = {soa[0] + i, soa[1] + i, soa[2] + i, dim > 3 ? soa[3] + i : nullptr};
+      soa_to_aos_scalar<dim>(t, aos + dim * i, n - i, false);
+    }
+
+#ifdef JW_MATH_X86
+    JW_MATH_TARGET("sse2") inline void aos_to_soa3_sse2(const f32 *aos, f32 *const soa[4], size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const f32 *p = aos + 3 * i;
+        __m128 x, y, z;
+        deinterleave3_sse2(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), x, y, z);
+        store_sse2(soa[0] + i, x, stream);
+        store_sse2(soa[1] + i, y, stream);
+        store_sse2(soa[2] + i, z, stream);
+      }
+      aos_to_soa_tail<3>(aos, soa, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_to_aos3_sse2(const f32 *const soa[4], f32 *aos, size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 a, b, c;
+        interleave3_sse2(_mm_loadu_ps(soa[0] + i), _mm_loadu_ps(soa[1] + i), _mm_loadu_ps(soa[2] + i), a, b, c);
+        f32 *p = aos + 3 * i;
+        store_sse2(p, a, stream);
+        store_sse2(p + 4, b, stream);
+        store_sse2(p + 8, c, stream);
+      }
+      soa_to_aos_tail<3>(soa, aos, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("sse4.1") inline void aos_to_soa3_sse41(const f32 *aos, f32 *const soa[4], size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const f32 *p = aos + 3 * i;
+        __m128 x, y, z;
+        deinterleave3_sse41(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), x, y, z);
+        store_sse2(soa[0] + i, x, stream);
+        store_sse2(soa[1] + i, y, stream);
+        store_sse2(soa[2] + i, z, stream);
+      }
+      aos_to_soa_tail<3>(aos, soa, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("sse4.1") inline void soa_to_aos3_sse41(const f32 *const soa[4], f32 *aos, size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 a, b, c;
+        interleave3_sse41(_mm_loadu_ps(soa[0] + i), _mm_loadu_ps(soa[1] + i), _mm_loadu_ps(soa[2] + i), a, b, c);
+        f32 *p = aos + 3 * i;
+        store_sse2(p, a, stream);
+        store_sse2(p + 4, b, stream);
+        store_sse2(p + 8, c, stream);
+      }
+      soa_to_aos_tail<3>(soa, aos, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("sse2") inline void aos_to_soa4_sse2(const f32 *aos, f32 *const soa[4], size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const f32 *p = aos + 4 * i;
+        __m128 r0 = _mm_loadu_ps(p), r1 = _mm_loadu_ps(p + 4), r2 = _mm_loadu_ps(p + 8), r3 = _mm_loadu_ps(p + 12);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        store_sse2(soa[0] + i, r0, stream);
+        store_sse2(soa[1] + i, r1, stream);
+        store_sse2(soa[2] + i, r2, stream);
+        store_sse2(soa[3] + i, r3, stream);
+      }
+      aos_to_soa_tail<4>(aos, soa, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("sse2") inline void soa_to_aos4_sse2(const f32 *const soa[4], f32 *aos, size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 r0 = _mm_loadu_ps(soa[0] + i), r1 = _mm_loadu_ps(soa[1] + i), r2 = _mm_loadu_ps(soa[2] + i), r3 = _mm_loadu_ps(soa[3] + i);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        f32 *p = aos + 4 * i;
+        store_sse2(p, r0, stream);
+        store_sse2(p + 4, r1, stream);
+        store_sse2(p + 8, r2, stream);
+        store_sse2(p + 12, r3, stream);
+      }
+      soa_to_aos_tail<4>(soa, aos, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("avx") inline void aos_to_soa3_avx(const f32 *aos, f32 *const soa[4], size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 x, y, z;
+        load_deinterleave3_avx(aos + 3 * i, x, y, z);
+        store2_m128(soa[0] + i, x, stream);
+        store2_m128(soa[1] + i, y, stream);
+        store2_m128(soa[2] + i, z, stream);
+      }
+      aos_to_soa_tail<3>(aos, soa, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_to_aos3_avx(const f32 *const soa[4], f32 *aos, size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+        interleave3_store_avx(_mm256_loadu_ps(soa[0] + i), _mm256_loadu_ps(soa[1] + i), _mm256_loadu_ps(soa[2] + i), aos + 3 * i, stream);
+      soa_to_aos_tail<3>(soa, aos, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("avx") inline void aos_to_soa4_avx(const f32 *aos, f32 *const soa[4], size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const f32 *p = aos + 4 * i;
+        __m256 r0 = load2_m128(p, p + 16), r1 = load2_m128(p + 4, p + 20), r2 = load2_m128(p + 8, p + 24), r3 = load2_m128(p + 12, p + 28);
+        transpose4_avx(r0, r1, r2, r3);
+        store2_m128(soa[0] + i, r0, stream);
+        store2_m128(soa[1] + i, r1, stream);
+        store2_m128(soa[2] + i, r2, stream);
+        store2_m128(soa[3] + i, r3, stream);
+      }
+      aos_to_soa_tail<4>(aos, soa, i, n);
+      stream_fence(stream);
+    }
+
+    JW_MATH_TARGET("avx") inline void soa_to_aos4_avx(const f32 *const soa[4], f32 *aos, size_t n, bool stream)
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 r[4] = {_mm256_loadu_ps(soa[0] + i), _mm256_loadu_ps(soa[1] + i), _mm256_loadu_ps(soa[2] + i), _mm256_loadu_ps(soa[3] + i)};
+        transpose4_avx(r[0], r[1], r[2], r[3]);
+        f32 *p = aos + 4 * i;
+        for (int j = 0; j < 4; j++)
+        {
+          store_sse2(p + 4 * j, _mm256_castps256_ps128(r[j]), stream);
+          store_sse2(p + 16 + 4 * j, _mm256_extractf128_ps(r[j], 1), stream);
+        }
+      }
+      soa_to_aos_tail<4>(soa, aos, i, n);
+      stream_fence(stream);
+    }
+#endif
+
+    // One-pass reductions over vec3 arrays. Sums are taken relative to a reference
+    // point k, the first element, which keeps the second moments from cancelling for
+    // points far from the origin. SIMD paths accumulate f32 partial sums in blocks of
+    // REDUCE_BLOCK elements and add each block to the f64 totals, so the error does
+    // not grow with n. bounds selects lo/hi and order 1 or 2 the sums s (of p - k)
+    // and s2 (of its products xx, xy, xz, yy, yz, zz).
+
+    const size_t REDUCE_BLOCK = 1024;
+
+    struct reduce3_result
+    {
+      f32 k[3], lo[3], hi[3];
+      f64 s[3], s2[6];
+    };
+
+    template <bool bounds, int order>
+    inline void reduce3_scalar(const f32 *v, size_t n, reduce3_result &r)
+    {
+      for (size_t i = 0; i < 3 * n; i += 3)
+      {
+        for (int c = 0; bounds && c < 3; c++)
+        {
+          r.lo[c] = v[i + c] < r.lo[c] ? v[i + c] : r.lo[c];
+          r.hi[c] = v[i + c] > r.hi[c] ? v[i + c] : r.hi[c];
+        }
+        if (order == 0)
+          continue;
+        f64 d[3] = {v[i] - r.k[0], v[i + 1] - r.k[1], v[i + 2] - r.k[2]};
+        for (int c = 0; c < 3; c++)
+          r.s[c] += d[c];
+        if (order == 2)
+          for (int a = 0, j = 0; a < 3; a++)
+            for (int b = a; b < 3; b++)
+              r.s2[j++] += d[a] * d[b];
+      }
+    }
+
+#ifdef JW_MATH_X86
+    JW_MATH_TARGET("sse2") inline f32 hsum_sse2(__m128 a)
+    {
+      return _mm_cvtss_f32(dot4_sse2(a, _mm_set1_ps(1.0F)));
+    }
+
+    // Four vec3 per step, deinterleaved as in transform3_sse2. With second moments
+    // there are already nine independent sums in flight, otherwise two steps per
+    // iteration go to separate accumulators to hide the add latency.
+    template <bool bounds, int order>
+    JW_MATH_TARGET("sse2") inline void reduce3_sse2(const f32 *v, size_t n, reduce3_result &r)
+    {
+      const int u = order == 2 ? 1 : 2;
+      const __m128 k[3] = {_mm_set1_ps(r.k[0]), _mm_set1_ps(r.k[1]), _mm_set1_ps(r.k[2])};
+      __m128 lo[u][3], hi[u][3];
+      for (int a = 0; a < u; a++)
+        for (int c = 0; c < 3; c++)
+        {
+          lo[a][c] = _mm_set1_ps(r.lo[c]);
+          hi[a][c] = _mm_set1_ps(r.hi[c]);
+        }
+
+      size_t i = 0;
+      while (i + 4 * u <= n)
+      {
+        size_t end = n - i > REDUCE_BLOCK ? i + REDUCE_BLOCK : n;
+        __m128 s[u][3], s2[6];
+        for (int a = 0; a < u; a++)
+          for (int c = 0; c < 3; c++)
+            s[a][c] = _mm_setzero_ps();
+        for (int j = 0; j < 6; j++)
+          s2[j] = _mm_setzero_ps();
+
+        for (; i + 4 * u <= end; i += 4 * u)
+          for (int a = 0; a < u; a++)
+          {
+            const f32 *p = v + 3 * (i + 4 * a);
+            __m128 d[3];
+            deinterleave3_sse2(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), d[0], d[1], d[2]);
+            for (int c = 0; bounds && c < 3; c++)
+            {
+              lo[a][c] = _mm_min_ps(lo[a][c], d[c]);
+              hi[a][c] = _mm_max_ps(hi[a][c], d[c]);
+            }
+            if (order == 0)
+              continue;
+            for (int c = 0; c < 3; c++)
+            {
+              d[c] = _mm_sub_ps(d[c], k[c]);
+              s[a][c] = _mm_add_ps(s[a][c], d[c]);
+            }
+            if (order == 2)
+              for (int b = 0, j = 0; b < 3; b++)
+                for (int c = b; c < 3; c++, j++)
+                  s2[j] = _mm_add_ps(s2[j], _mm_mul_ps(d[b], d[c]));
+          }
+
+        for (int c = 0; order > 0 && c < 3; c++)
+          r.s[c] += hsum_sse2(u == 2 ? _mm_add_ps(s[0][c], s[u - 1][c]) : s[0][c]);
+        for (int j = 0; order == 2 && j < 6; j++)
+          r.s2[j] += hsum_sse2(s2[j]);
+      }
+
+      for (int c = 0; bounds && c < 3; c++)
+      {
+        f32 t[8];
+        _mm_storeu_ps(t, _mm_min_ps(lo[0][c], lo[u - 1][c]));
+        _mm_storeu_ps(t + 4, _mm_max_ps(hi[0][c], hi[u - 1][c]));
+        for (int j = 0; j < 4; j++)
+        {
+          r.lo[c] = t[j] < r.lo[c] ? t[j] : r.lo[c];
+          r.hi[c] = t[4 + j] > r.hi[c] ? t[4 + j] : r.hi[c];
+        }
+      }
+      reduce3_scalar<bounds, order>(v + 3 * i, n - i, r);
+    }
+
+    JW_MATH_TARGET("avx") inline f32 hsum_avx(__m256 a)
+    {
+      __m128 t = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+      t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+      return _mm_cvtss_f32(_mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1))));
+    }
+
+    // the same with eight vec3 per step, see load_deinterleave3_avx
+    template <bool bounds, int order>
+    JW_MATH_TARGET("avx") inline void reduce3_avx(const f32 *v, size_t n, reduce3_result &r)
+    {
+      const int u = order == 2 ? 1 : 2;
+      const __m256 k[3] = {_mm256_set1_ps(r.k[0]), _mm256_set1_ps(r.k[1]), _mm256_set1_ps(r.k[2])};
+      __m256 lo[u][3], hi[u][3];
+      for (int a = 0; a < u; a++)
+        for (int c = 0; c < 3; c++)
+        {
+          lo[a][c] = _mm256_set1_ps(r.lo[c]);
+          hi[a][c] = _mm256_set1_ps(r.hi[c]);
+        }
+
+      size_t i = 0;
+      while (i + 8 * u <= n)
+      {
+        size_t end = n - i > REDUCE_BLOCK ? i + REDUCE_BLOCK : n;
+        __m256 s[u][3], s2[6];
+        for (int a = 0; a < u; a++)
+          for (int c = 0; c < 3; c++)
+            s[a][c] = _mm256_setzero_ps();
+        for (int j = 0; j < 6; j++)
+          s2[j] = _mm256_setzero_ps();
+
+        for (; i + 8 * u <= end; i += 8 * u)
+          for (int a = 0; a < u; a++)
+          {
+            __m256 d[3];
+            load_deinterleave3_avx(v + 3 * (i + 8 * a), d[0], d[1], d[2]);
+            for (int c = 0; bounds && c < 3; c++)
+            {
+              lo[a][c] = _mm256_min_ps(lo[a][c], d[c]);
+              hi[a][c] = _mm256_max_ps(hi[a][c], d[c]);
+            }
+            if (order == 0)
+              continue;
+            for (int c = 0; c < 3; c++)
+            {
+              d[c] = _mm256_sub_ps(d[c], k[c]);
+              s[a][c] = _mm256_add_ps(s[a][c], d[c]);
+            }
+            if (order == 2)
+              for (int b = 0, j = 0; b < 3; b++)
+                for (int c = b; c < 3; c++, j++)
+                  s2[j] = _mm256_add_ps(s2[j], _mm256_mul_ps(d[b], d[c]));
+          }
+
+        for (int c = 0; order > 0 && c < 3; c++)
+          r.s[c] += hsum_avx(u == 2 ? _mm256_add_ps(s[0][c], s[u - 1][c]) : s[0][c]);
+        for (int j = 0; order == 2 && j < 6; j++)
+          r.s2[j] += hsum_avx(s2[j]);
+      }
+
+      for (int c = 0; bounds && c < 3; c++)
+      {
+        f32 t[16];
+        _mm256_storeu_ps(t, _mm256_min_ps(lo[0][c], lo[u - 1][c]));
+        _mm256_storeu_ps(t + 8, _mm256_max_ps(hi[0][c], hi[u - 1][c]));
+        for (int j = 0; j < 8; j++)
+        {
+          r.lo[c] = t[j] < r.lo[c] ? t[j] : r.lo[c];
+          r.hi[c] = t[8 + j] > r.hi[c] ? t[8 + j] : r.hi[c];
+        }
+      }
+      reduce3_sse2<bounds, order>(v + 3 * i, n - i, r);
+    }
+#endif
+
+    // Dot products over arrays, each ((a.x * b.x + a.y * b.y) + a.z * b.z) + w on
+    // every path, without FMA, so results (and plane classifications built on them)
+    // do not depend on the ISA. With single set, a is one vector applied to all of b.
+
+    template <bool single>
+    inline void dot3_scalar(const f32 *a, const f32 *b, f32 *out, size_t n, f32 w)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        const f32 *p = single ? a : a + 3 * i, *q = b + 3 * i;
+        out[i] = p[0] * q[0] + p[1] * q[1] + p[2] * q[2] + w;
+      }
+    }
+
+    template <bool single>
+    inline void dot4_scalar(const f32 *a, const f32 *b, f32 *out, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        const f32 *p = single ? a : a + 4 * i, *q = b + 4 * i;
+        out[i] = p[0] * q[0] + p[1] * q[1] + p[2] * q[2] + p[3] * q[3];
+      }
+    }
+
+    // out[i] = a . (b[0][i], b[1][i], b[2][i], b[3][i]), where a null b[3] means 1
+    inline void dot_soa_one_scalar(const f32 a[4], const f32 *const b[4], f32 *out, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+        out[i] = a[0] * b[0][i] + a[1] * b[1][i] + a[2] * b[2][i] + (b[3] ? a[3] * b[3][i] : a[3]);
+    }
+
+    // Bit i of masks[0], masks[1] and masks[2] (each optional) is set where d[i] > e,
+    // d[i] < -e and neither, respectively. Whole words are written.
+    inline void classify_scalar(const f32 *d, size_t n, f32 e, u32 *const masks[3])
+    {
+      for (size_t i = 0; i < n; i += 32)
+      {
+        u32 front = 0, back = 0, valid = n - i >= 32 ? ~0U : (1U << (n - i)) - 1;
+        for (size_t j = 0; j < 32 && i + j < n; j++)
+        {
+          front |= (u32)(d[i + j] > e) << j;
+          back |= (u32)(d[i + j] < -e) << j;
+        }
+        u32 bits[3] = {front, back, valid & ~(front | back)};
+        for (int k = 0; k < 3; k++)
+          if (masks[k])
+            masks[k][i / 32] = bits[k];
+      }
+    }
+
+#ifdef JW_MATH_X86
+    template <bool single>
+    JW_MATH_TARGET("sse2") inline void dot3_sse2(const f32 *a, const f32 *b, f32 *out, size_t n, f32 w)
+    {
+      // a is only one vector when single, otherwise it is read per block
+      __m128 ax = _mm_setzero_ps(), ay = ax, az = ax, c = _mm_set1_ps(w);
+      if (single)
+        ax = _mm_set1_ps(a[0]), ay = _mm_set1_ps(a[1]), az = _mm_set1_ps(a[2]);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 x, y, z;
+        deinterleave3_sse2(_mm_loadu_ps(b + 3 * i), _mm_loadu_ps(b + 3 * i + 4), _mm_loadu_ps(b + 3 * i + 8), x, y, z);
+        if (!single)
+          deinterleave3_sse2(_mm_loadu_ps(a + 3 * i), _mm_loadu_ps(a + 3 * i + 4), _mm_loadu_ps(a + 3 * i + 8), ax, ay, az);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, x), _mm_mul_ps(ay, y)), _mm_mul_ps(az, z));
+        _mm_storeu_ps(out + i, _mm_add_ps(d, c));
+      }
+      dot3_scalar<single>(single ? a : a + 3 * i, b + 3 * i, out + i, n - i, w);
+    }
+
+    template <bool single>
+    JW_MATH_TARGET("sse2") inline void dot4_sse2(const f32 *a, const f32 *b, f32 *out, size_t n)
+    {
+      __m128 ax = _mm_setzero_ps(), ay = ax, az = ax, aw = ax;
+      if (single)
+        ax = _mm_set1_ps(a[0]), ay = _mm_set1_ps(a[1]), az = _mm_set1_ps(a[2]), aw = _mm_set1_ps(a[3]);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const f32 *q = b + 4 * i;
+        __m128 x = _mm_loadu_ps(q), y = _mm_loadu_ps(q + 4), z = _mm_loadu_ps(q + 8), w = _mm_loadu_ps(q + 12);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        if (!single)
+        {
+          const f32 *p = a + 4 * i;
+          ax = _mm_loadu_ps(p), ay = _mm_loadu_ps(p + 4), az = _mm_loadu_ps(p + 8), aw = _mm_loadu_ps(p + 12);
+          _MM_TRANSPOSE4_PS(ax, ay, az, aw);
+        }
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, x), _mm_mul_ps(ay, y)), _mm_mul_ps(az, z));
+        _mm_storeu_ps(out + i, _mm_add_ps(d, _mm_mul_ps(aw, w)));
+      }
+      dot4_scalar<single>(single ? a : a + 4 * i, b + 4 * i, out + i, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline void dot_soa_one_sse2(const f32 a[4], const f32 *const b[4], f32 *out, size_t n)
+    {
+      __m128 ax = _mm_set1_ps(a[0]), ay = _mm_set1_ps(a[1]), az = _mm_set1_ps(a[2]), aw = _mm_set1_ps(a[3]);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, _mm_loadu_ps(b[0] + i)), _mm_mul_ps(ay, _mm_loadu_ps(b[1] + i))), _mm_mul_ps(az, _mm_loadu_ps(b[2] + i)));
+        _mm_storeu_ps(out + i, _mm_add_ps(d, b[3] ? _mm_mul_ps(aw, _mm_loadu_ps(b[3] + i)) : aw));
+      }
+      const f32 *t[4] = {b[0] + i, b[1] + i, b[2] + i, b[3] ? b[3] + i : nullptr};
+      dot_soa_one_scalar(a, t, out + i, n - i);
+    }
+
+    JW_MATH_TARGET("sse2") inline void classify_sse2(const f32 *d, size_t n, f32 e, u32 *const masks[3])
+    {
+      __m128 pe = _mm_set1_ps(e), ne = _mm_set1_ps(-e);
+      size_t i = 0;
+      for (; i + 32 <= n; i += 32)
+      {
+        u32 front = 0, back = 0;
+        for (int j = 0; j < 8; j++)
+        {
+          __m128 v = _mm_loadu_ps(d + i + 4 * j);
+          front |= (u32)_mm_movemask_ps(_mm_cmpgt_ps(v, pe)) << (4 * j);
+          back |= (u32)_mm_movemask_ps(_mm_cmplt_ps(v, ne)) << (4 * j);
+        }
+        u32 bits[3] = {front, back, ~(front | back)};
+        for (int k = 0; k < 3; k++)
+          if (masks[k])
+            masks[k][i / 32] = bits[k];
+      }
+      u32 *tail[3] = {masks[0] ? masks[0] + i / 32 : nullptr, masks[1] ? masks[1] + i / 32 : nullptr, masks[2] ? masks[2] + i / 32 : nullptr};
+      classify_scalar(d + i, n - i, e, tail);
+    }
+
+    template <bool single>
+    JW_MATH_TARGET("avx") inline void dot3_avx(const f32 *a, const f32 *b, f32 *out, size_t n, f32 w)
+    {
+      __m256 ax = _mm256_setzero_ps(), ay = ax, az = ax, c = _mm256_set1_ps(w);
+      if (single)
+        ax = _mm256_set1_ps(a[0]), ay = _mm256_set1_ps(a[1]), az = _mm256_set1_ps(a[2]);
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 x, y, z;
+        load_deinterleave3_avx(b + 3 * i, x, y, z);
+        if (!single)
+          load_deinterleave3_avx(a + 3 * i, ax, ay, az);
+        __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, x), _mm256_mul_ps(ay, y)), _mm256_mul_ps(az, z));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(d, c));
+      }
+      if (i < n)
+        dot3_sse2<single>(single ? a : a + 3 * i, b + 3 * i, out + i, n - i, w);
+    }
+
+    template <bool single>
+    JW_MATH_TARGET("avx") inline void dot4_avx(const f32 *a, const f32 *b, f32 *out, size_t n)
+    {
+      __m256 ax = _mm256_setzero_ps(), ay = ax, az = ax, aw = ax;
+      if (single)
+        ax = _mm256_set1_ps(a[0]), ay = _mm256_set1_ps(a[1]), az = _mm256_set1_ps(a[2]), aw = _mm256_set1_ps(a[3]);
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const f32 *q = b + 4 * i;
+        __m256 x = load2_m128(q, q + 16), y = load2_m128(q + 4, q + 20), z = load2_m128(q + 8, q + 24), w = load2_m128(q + 12, q + 28);
+        transpose4_avx(x, y, z, w);
+        if (!single)
+        {
+          const f32 *p = a + 4 * i;
+          ax = load2_m128(p, p + 16), ay = load2_m128(p + 4, p + 20), az = load2_m128(p + 8, p + 24), aw = load2_m128(p + 12, p + 28);
+          transpose4_avx(ax, ay, az, aw);
+        }
+        __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, x), _mm256_mul_ps(ay, y)), _mm256_mul_ps(az, z));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(d, _mm256_mul_ps(aw, w)));
+      }
+      if (i < n)
+        dot4_sse2<single>(single ? a : a + 4 * i, b + 4 * i, out + i, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void dot_soa_one_avx(const f32 a[4], const f32 *const b[4], f32 *out, size_t n)
+    {
+      __m256 ax = _mm256_set1_ps(a[0]), ay = _mm256_set1_ps(a[1]), az = _mm256_set1_ps(a[2]), aw = _mm256_set1_ps(a[3]);
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, _mm256_loadu_ps(b[0] + i)), _mm256_mul_ps(ay, _mm256_loadu_ps(b[1] + i))), _mm256_mul_ps(az, _mm256_loadu_ps(b[2] + i)));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(d, b[3] ? _mm256_mul_ps(aw, _mm256_loadu_ps(b[3] + i)) : aw));
+      }
+      const f32 *t[4] = {b[0] + i, b[1] + i, b[2] + i, b[3] ? b[3] + i : nullptr};
+      dot_soa_one_sse2(a, t, out + i, n - i);
+    }
+
+    JW_MATH_TARGET("avx") inline void classify_avx(const f32 *d, size_t n, f32 e, u32 *const masks[3])
+    {
+      __m256 pe = _mm256_set1_ps(e), ne = _mm256_set1_ps(-e);
+      size_t i = 0;
+      for (; i + 32 <= n; i += 32)
+      {
+        u32 front = 0, back = 0;
+        for (int j = 0; j < 4; j++)
+        {
+          __m256 v = _mm256_loadu_ps(d + i + 8 * j);
+          front |= (u32)_mm256_movemask_ps(_mm256_cmp_ps(v, pe, _CMP_GT_OQ)) << (8 * j);
+          back |= (u32)_mm256_movemask_ps(_mm256_cmp_ps(v, ne, _CMP_LT_OQ)) << (8 * j);
+        }
+        u32 bits[3] = {front, back, ~(front | back)};
+        for (int k = 0; k < 3; k++)
+          if (masks[k])
+            masks[k][i / 32] = bits[k];
+      }
+      u32 *tail[3] = {masks[0] ? masks[0] + i / 32 : nullptr, masks[1] ? masks[1] + i / 32 : nullptr, masks[2] ? masks[2] + i / 32 : nullptr};
+      classify_sse2(d + i, n - i, e, tail);
+    }
+#endif
+
+    // Perspective divide and viewport mapping of clip-space vec4 to vec3 screen
+    // coordinates: s = c.xyz / c.w * vp[0..2] + vp[3..5]. Vertices with w <= 0 (or
+    // NaN) produce zero and set bit i of the optional behind mask.
+
+    inline void set_mask_bits(u32 *mask, size_t i, u32 bits)
+    {
+      if (mask)
+        mask[i / 32] |= bits << (i % 32);
+    }
+
+    inline void project_to_screen_scalar(const f32 *clip, f32 *screen, u32 *mask, size_t n, const f32 vp[6])
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        const f32 *c = clip + 4 * i;
+        f32 *s = screen + 3 * i;
+        bool ok = c[3] > 0.0F;
+        f32 r = ok ? 1.0F / c[3] : 0.0F;
+        for (int k = 0; k < 3; k++)
+          s[k] = ok ? c[k] * r * vp[k] + vp[3 + k] : 0.0F;
+        set_mask_bits(mask, i, ok ? 0 : 1);
+      }
+    }
+
+#ifdef JW_MATH_X86
+    // Reciprocal estimate refined by one Newton-Raphson step, zero where w <= 0.
+    // rcp returns inf for a subnormal w, so those lanes are divided exactly as in
+    // the scalar kernel instead.
+    JW_MATH_TARGET("sse2") inline __m128 rcp_nr_sse2(__m128 w, __m128 ok)
+    {
+      __m128 r = _mm_rcp_ps(w);
+      r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(2.0F), _mm_mul_ps(w, r)));
+      __m128 tiny = _mm_and_ps(_mm_cmplt_ps(w, _mm_set1_ps(FLT_MIN)), ok);
+      if (_mm_movemask_ps(tiny))
+        r = _mm_or_ps(_mm_andnot_ps(tiny, r), _mm_and_ps(tiny, _mm_div_ps(_mm_set1_ps(1.0F), w)));
+      return _mm_and_ps(r, ok);
+    }
+
+    // projects min(n - i, 4) vertices starting at i, which is a multiple of 4
+    JW_MATH_TARGET("sse2") inline void project_screen4_sse2(const f32 *clip, f32 *screen, u32 *mask, size_t i, size_t n, const f32 vp[6])
+    {
+      size_t m = n - i < 4 ? n - i : 4;
+      f32 in[16] = {}, out[12];
+      const f32 *c = clip + 4 * i;
+      if (m < 4)
+      {
+        memcpy(in, c, 4 * m * sizeof(f32));
+        c = in;
+      }
+      __m128 x = _mm_loadu_ps(c), y = _mm_loadu_ps(c + 4), z = _mm_loadu_ps(c + 8), w = _mm_loadu_ps(c + 12);
+      _MM_TRANSPOSE4_PS(x, y, z, w);
+      __m128 ok = _mm_cmpgt_ps(w, _mm_setzero_ps());
+      __m128 r = rcp_nr_sse2(w, ok);
+      x = _mm_and_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(x, r), _mm_set1_ps(vp[0])), _mm_set1_ps(vp[3])), ok);
+      y = _mm_and_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, r), _mm_set1_ps(vp[1])), _mm_set1_ps(vp[4])), ok);
+      z = _mm_and_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(z, r), _mm_set1_ps(vp[2])), _mm_set1_ps(vp[5])), ok);
+      __m128 a, b, d;
+      interleave3_sse2(x, y, z, a, b, d);
+      f32 *s = m < 4 ? out : screen + 3 * i;
+      _mm_storeu_ps(s, a);
+      _mm_storeu_ps(s + 4, b);
+      _mm_storeu_ps(s + 8, d);
+      if (m < 4)
+        memcpy(screen + 3 * i, out, 3 * m * sizeof(f32));
+      set_mask_bits(mask, i, ~_mm_movemask_ps(ok) & ((1U << m) - 1));
+    }
+
+    JW_MATH_TARGET("sse2") inline void project_to_screen_sse2(const f32 *clip, f32 *screen, u32 *mask, size_t n, const f32 vp[6])
+    {
+      for (size_t i = 0; i < n; i += 4)
+        project_screen4_sse2(clip, screen, mask, i, n, vp);
+    }
+
+    JW_MATH_TARGET("avx") inline void project_to_screen_avx(const f32 *clip, f32 *screen, u32 *mask, size_t n, const f32 vp[6])
+    {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const f32 *c = clip + 4 * i;
+        __m256 x = load2_m128(c, c + 16), y = load2_m128(c + 4, c + 20), z = load2_m128(c + 8, c + 24), w = load2_m128(c + 12, c + 28);
+        transpose4_avx(x, y, z, w);
+        __m256 ok = _mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_GT_OQ);
+        __m256 r = _mm256_rcp_ps(w);
+        r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(2.0F), _mm256_mul_ps(w, r)));
+        __m256 tiny = _mm256_and_ps(_mm256_cmp_ps(w, _mm256_set1_ps(FLT_MIN), _CMP_LT_OQ), ok);
+        if (_mm256_movemask_ps(tiny))
+          r = _mm256_blendv_ps(r, _mm256_div_ps(_mm256_set1_ps(1.0F), w), tiny);
+        r = _mm256_and_ps(r, ok);
+        x = _mm256_and_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(x, r), _mm256_set1_ps(vp[0])), _mm256_set1_ps(vp[3])), ok);
+        y = _mm256_and_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(vp[1])), _mm256_set1_ps(vp[4])), ok);
+        z = _mm256_and_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(z, r), _mm256_set1_ps(vp[2])), _mm256_set1_ps(vp[5])), ok);
+        interleave3_store_avx(x, y, z, screen + 3 * i, false);
+        set_mask_bits(mask, i, ~_mm256_movemask_ps(ok) & 0xFF);
+      }
+      for (; i < n; i += 4)
+        project_screen4_sse2(clip, screen, mask, i, n, vp);
+    }
+#endif
+
+    struct dispatch_table
+    {
+      isa level;
+      void (*mat4_mul_batch)(const f32 *a, const f32 *b, f32 *r, size_t n);
+      void (*transform_soa)(const f32 *m, const f32 *const in[4], f32 *const out[4], size_t n, bool stream);
+      void (*normalize3)(f32 *v, size_t n);
+      void (*normalize4)(f32 *v, size_t n);
+      void (*normalize2_fast)(f32 *v, size_t n);
+      void (*normalize3_fast)(f32 *v, size_t n);
+      void (*normalize4_fast)(f32 *v, size_t n);
+      void (*transform3)(const f32 *m, const f32 *in, f32 *out, size_t n, transform_kind kind, bool stream);
+      void (*soa_add)(const f32 *a, const f32 *b, f32 *r, size_t n);
+      void (*soa_sub)(const f32 *a, const f32 *b, f32 *r, size_t n);
+      void (*soa_scale)(const f32 *a, f32 s, f32 *r, size_t n);
+      void (*soa_lerp)(const f32 *a, const f32 *b, f32 t, f32 *r, size_t n);
+      void (*soa_dot)(const f32 *const a[4], const f32 *const b[4], int dim, f32 *r, size_t n);
+      void (*soa_length)(const f32 *const a[4], int dim, f32 *r, size_t n);
+      void (*soa_normalize)(f32 *const a[4], int dim, size_t n);
+      void (*soa_cross)(const f32 *const a[3], const f32 *const b[3], f32 *const r[3], size_t n);
+      void (*aos_to_soa3)(const f32 *aos, f32 *const soa[4], size_t n, bool stream);
+      void (*aos_to_soa4)(const f32 *aos, f32 *const soa[4], size_t n, bool stream);
+      void (*soa_to_aos3)(const f32 *const soa[4], f32 *aos, size_t n, bool stream);
+      void (*soa_to_aos4)(const f32 *const soa[4], f32 *aos, size_t n, bool stream);
+      void (*project_to_screen)(const f32 *clip, f32 *screen, u32 *mask, size_t n, const f32 vp[6]);
+      void (*bounds3)(const f32 *v, size_t n, reduce3_result &r);
+      void (*sum3)(const f32 *v, size_t n, reduce3_result &r);
+      void (*moments3)(const f32 *v, size_t n, reduce3_result &r);
+      void (*dot3)(const f32 *a, const f32 *b, f32 *out, size_t n, f32 w);
+      void (*dot3_one)(const f32 *a, const f32 *b, f32 *out, size_t n, f32 w);
+      void (*dot4)(const f32 *a, const f32 *b, f32 *out, size_t n);
+      void (*dot4_one)(const f32 *a, const f32 *b, f32 *out, size_t n);
+      void (*dot_soa_one)(const f32 a[4], const f32 *const b[4], f32 *out, size_t n);
+      void (*classify)(const f32 *d, size_t n, f32 e, u32 *const masks[3]);
+      f32 (*mat4_inverse)(const f32 *m, f32 *r);
+      size_t (*mat4_inverse_batch)(const f32 *m, f32 *r, f32 *det, size_t n);
+      void (*affine3_mul_batch)(const f32 *a, const f32 *b, f32 *r, size_t n);
+      void (*mat3_mul_batch)(const f32 *a, const f32 *b, f32 *r, size_t n);
+      void (*normal_matrix3_batch)(const f32 *m, f32 *r, size_t n);
+      void (*mvp_batch)(const f32 *vp, const f32 *v, const f32 *model, f32 *mvp, f32 *mv, f32 *nrm, size_t n, bool stream);
+      void (*quat_to_mat4_soa)(const f32 *const q[4], const f32 *const t[3], const f32 *const s[3], f32 *out, size_t n, bool affine, bool stream);
+    };
+
+    inline isa supported_isa()
+    {
+      const cpu_features &f = cpu();
+      if (f.avx512f && f.avx2 && f.fma)
+        return isa::avx512;
+      if (f.avx2 && f.fma)
+        return isa::avx2;
+      if (f.avx && f.sse41)
+        return isa::avx;
+      if (f.sse41 && f.sse2)
+        return isa::sse41;
+      if (f.sse2)
+        return isa::sse2;
+      return isa::scalar;
+    }
+
+    // The JW_MATH_ISA environment variable may lower the level for benchmarking,
+    // but never raises it beyond what the CPU supports. It only affects the batch
+    // and array APIs: operations on single objects, such as mat4 * mat4 and
+    // mat4 * vec4, are inlined and selected at compile time (SSE2 when the
+    // compiler targets it); compare those against scalar code by building with
+    // JW_MATH_NO_SIMD.
+    inline isa select_isa()
+    {
+      isa level = supported_isa();
+#if defined(_MSC_VER)
+#pragma warning(suppress : 4996)
+#endif
+      const char *requested = getenv("JW_MATH_ISA");
+      if (!requested)
+        return level;
+
+      for (int i = (int)isa::scalar; i <= (int)level; i++)
+        if (strcmp(requested, isa_name((isa)i)) == 0)
+          return (isa)i;
+      return level;
+    }
+
+    inline dispatch_table make_dispatch_table(isa level)
+    {
+      dispatch_table t;
+      t.level = level;
+      t.mat4_mul_batch = mat4_mul_batch_scalar;
+      t.transform_soa = transform_soa_scalar;
+      t.normalize3 = normalize3_scalar;
+      t.normalize4 = normalize4_scalar;
+      t.normalize2_fast = normalize_fast_scalar<2>;
+      t.normalize3_fast = normalize_fast_scalar<3>;
+      t.normalize4_fast = normalize_fast_scalar<4>;
+      t.transform3 = transform3_scalar;
+      t.soa_add = soa_add_scalar;
+      t.soa_sub = soa_sub_scalar;
+      t.soa_scale = soa_scale_scalar;
+      t.soa_lerp = soa_lerp_scalar;
+      t.soa_dot = soa_dot_scalar;
+      t.soa_length = soa_length_scalar;
+      t.soa_normalize = soa_normalize_scalar;
+      t.soa_cross = soa_cross_scalar;
+      t.aos_to_soa3 = aos_to_soa_scalar<3>;
+      t.aos_to_soa4 = aos_to_soa_scalar<4>;
+      t.soa_to_aos3 = soa_to_aos_scalar<3>;
+      t.soa_to_aos4 = soa_to_aos_scalar<4>;
+      t.project_to_screen = project_to_screen_scalar;
+      t.dot3 = dot3_scalar<false>;
+      t.dot3_one = dot3_scalar<true>;
+      t.dot4 = dot4_scalar<false>;
+      t.dot4_one = dot4_scalar<true>;
+      t.dot_soa_one = dot_soa_one_scalar;
+      t.classify = classify_scalar;
+      t.mat4_inverse = mat4_inverse_scalar;
+      t.mat4_inverse_batch = mat4_inverse_batch_scalar;
+      t.affine3_mul_batch = affine3_mul_batch_scalar;
+      t.mat3_mul_batch = mat3_mul_batch_scalar;
+      t.normal_matrix3_batch = normal_matrix3_batch_scalar;
+      t.bounds3 = reduce3_scalar<true, 0>;
+      t.sum3 = reduce3_scalar<false, 1>;
+      t.moments3 = reduce3_scalar<true, 2>;
+      t.mvp_batch = mvp_batch_scalar;
+      t.quat_to_mat4_soa = quat_to_mat4_soa_scalar;
+#ifdef JW_MATH_X86
+      if (level >= isa::sse2)
+      {
+        t.mat4_mul_batch = mat4_mul_batch_sse2;
+        t.normalize3 = normalize3_sse2;
+        t.normalize4 = normalize4_sse2;
+        t.normalize2_fast = normalize2_fast_sse2;
+        t.normalize3_fast = normalize3_fast_sse2;
+        t.normalize4_fast = normalize4_fast_sse2;
+        t.transform3 = transform3_sse2;
+        t.soa_add = soa_add_sse2;
+        t.soa_sub = soa_sub_sse2;
+        t.soa_scale = soa_scale_sse2;
+        t.soa_lerp = soa_lerp_sse2;
+        t.soa_dot = soa_dot_sse2;
+        t.soa_length = soa_length_sse2;
+        t.soa_normalize = soa_normalize_sse2;
+        t.soa_cross = soa_cross_sse2;
+        t.aos_to_soa3 = aos_to_soa3_sse2;
+        t.aos_to_soa4 = aos_to_soa4_sse2;
+        t.soa_to_aos3 = soa_to_aos3_sse2;
+        t.soa_to_aos4 = soa_to_aos4_sse2;
+        t.project_to_screen = project_to_screen_sse2;
+        t.dot3 = dot3_sse2<false>;
+        t.dot3_one = dot3_sse2<true>;
+        t.dot4 = dot4_sse2<false>;
+        t.dot4_one = dot4_sse2<true>;
+        t.dot_soa_one = dot_soa_one_sse2;
+        t.classify = classify_sse2;
+        t.mat4_inverse = mat4_inverse_sse2;
+        t.mat4_inverse_batch = mat4_inverse_batch_sse2;
+        t.affine3_mul_batch = affine3_mul_batch_sse2;
+        t.mat3_mul_batch = mat3_mul_batch_sse2;
+        t.normal_matrix3_batch = normal_matrix3_batch_sse2;
+        t.bounds3 = reduce3_sse2<true, 0>;
+        t.sum3 = reduce3_sse2<false, 1>;
+        t.moments3 = reduce3_sse2<true, 2>;
+        t.mvp_batch = mvp_batch_sse2;
+        t.quat_to_mat4_soa = quat_to_mat4_soa_sse2;
+      }
+      if (level >= isa::sse41)
+      {
+        t.normalize3 = normalize3_sse41;
+        t.aos_to_soa3 = aos_to_soa3_sse41;
+        t.soa_to_aos3 = soa_to_aos3_sse41;
+      }
+      if (level >= isa::avx)
+      {
+        t.normalize4 = normalize4_avx;
+        t.normalize4_fast = normalize4_fast_avx;
+        t.soa_add = soa_add_avx;
+        t.soa_sub = soa_sub_avx;
+        t.soa_scale = soa_scale_avx;
+        t.soa_lerp = soa_lerp_avx;
+        t.soa_dot = soa_dot_avx;
+        t.soa_length = soa_length_avx;
+        t.soa_normalize = soa_normalize_avx;
+        t.soa_cross = soa_cross_avx;
+        t.aos_to_soa3 = aos_to_soa3_avx;
+        t.aos_to_soa4 = aos_to_soa4_avx;
+        t.soa_to_aos3 = soa_to_aos3_avx;
+        t.soa_to_aos4 = soa_to_aos4_avx;
+        t.project_to_screen = project_to_screen_avx;
+        t.dot3 = dot3_avx<false>;
+        t.dot3_one = dot3_avx<true>;
+        t.dot4 = dot4_avx<false>;
+        t.dot4_one = dot4_avx<true>;
+        t.dot_soa_one = dot_soa_one_avx;
+        t.classify = classify_avx;
+        t.mat4_inverse_batch = mat4_inverse_batch_avx;
+        t.bounds3 = reduce3_avx<true, 0>;
+        t.sum3 = reduce3_avx<false, 1>;
+        t.moments3 = reduce3_avx<true, 2>;
+        t.quat_to_mat4_soa = quat_to_mat4_soa_avx;
+      }
+      if (level >= isa::avx2)
+      {
+        t.mat4_mul_batch = mat4_mul_batch_avx;
+        t.transform_soa = transform_soa_avx2;
+        t.transform3 = transform3_avx2;
+        t.mvp_batch = mvp_batch_avx;
+      }
+      if (level >= isa::avx512)
+      {
+        t.mat4_mul_batch = mat4_mul_batch_avx512;
+        t.transform_soa = transform_soa_avx512;
+      }
+#endif
+      return t;
+    }
+
+    // probed once, on first use
+    inline const dispatch_table &dispatch()
+    {
+      static const dispatch_table table = make_dispatch_table(select_isa());
+      return table;
+    }
+
+#ifndef JW_MATH_NO_THREADS
+    // Work-stealing pool shared by all parallel batch operations. A run splits a
+    // range of chunks evenly over the participating threads' queues, with the
+    // calling thread as participant 0. A thread that drains its own queue steals
+    // the back half of another's. Runs are serialized, and a run requested while
+    // another is in progress, or from inside a pool thread, executes inline.
+    class thread_pool
+    {
+    public:
+      static thread_pool &get()
+      {
+        static thread_pool pool;
+        return pool;
+      }
+
+      // 1 + the number of worker threads
+      size_t size() const
+      {
+        return workers.size() + 1;
+      }
+
+      template <class F>
+      void run(size_t chunks, size_t threads, F &f)
+      {
+        std::unique_lock<std::mutex> busy(run_mutex, std::try_to_lock);
+        size_t p = threads == 0 || threads > size() ? size() : threads;
+        if (p > chunks)
+          p = chunks;
+        if (!busy.owns_lock() || in_pool_thread() || p <= 1)
+        {
+          for (size_t c = 0; c < chunks; c++)
+            f(c);
+          return;
+        }
+
+        for (size_t k = 0; k < p; k++)
+        {
+          queues[k].begin = k * chunks / p;
+          queues[k].end = (k + 1) * chunks / p;
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          job = &invoke<F>;
+          context = &f;
+          participants = p;
+          finished = 0;
+          generation++;
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return finished == p - 1; });
+      }
+
+    private:
+      struct queue
+      {
+        std::mutex mutex;
+        size_t begin = 0, end = 0;
+      };
+
+      std::vector<std::thread> workers;
+      std::unique_ptr<queue[]> queues;
+      std::mutex run_mutex, mutex;
+      std::condition_variable wake, done;
+      void (*job)(void *, size_t) = nullptr;
+      void *context = nullptr;
+      size_t participants = 0, finished = 0, generation = 0;
+      bool stop = false;
+
+      thread_pool()
+      {
+        size_t n = std::thread::hardware_concurrency();
+        n = n > 1 ? n : 1;
+        queues.reset(new queue[n]);
+        for (size_t k = 1; k < n; k++)
+          workers.emplace_back([this, k] { worker(k); });
+      }
+
+      ~thread_pool()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stop = true;
+        }
+        wake.notify_all();
+        for (std::thread &t : workers)
+          t.join();
+      }
+
+      template <class F>
+      static void invoke(void *f, size_t c)
+      {
+        (*static_cast<F *>(f))(c);
+      }
+
+      static bool &in_pool_thread()
+      {
+        static thread_local bool flag = false;
+        return flag;
+      }
+
+      void worker(size_t k)
+      {
+        in_pool_thread() = true;
+        size_t seen = 0;
+        for (;;)
+        {
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stop || generation != seen; });
+            if (stop)
+              return;
+            seen = generation;
+            if (k >= participants)
+              continue;
+          }
+          work(k);
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished++;
+          }
+          done.notify_one();
+        }
+      }
+
+      void work(size_t k)
+      {
+        size_t c;
+        while (pop(k, c) || steal(k, c))
+          job(context, c);
+      }
+
+      bool pop(size_t k, size_t &c)
+      {
+        std::lock_guard<std::mutex> lock(queues[k].mutex);
+        if (queues[k].begin == queues[k].end)
+          return false;
+        c = queues[k].begin++;
+        return true;
+      }
+
+      bool steal(size_t k, size_t &c)
+      {
+        for (size_t i = 1; i < participants; i++)
+        {
+          queue &victim = queues[(k + i) % participants];
+          size_t begin, end;
+          {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.begin == victim.end)
+              continue;
+            end = victim.end;
+            begin = victim.end - (victim.end - victim.begin + 1) / 2;
+            victim.end = begin;
+          }
+          std::lock_guard<std::mutex> lock(queues[k].mutex);
+          queues[k].begin = begin + 1;
+          queues[k].end = end;
+          c = begin;
+          return true;
+        }
+        return false;
+      }
+    };
+#endif
+
+    // Parallel batches are cut into chunks whose inputs and outputs together fill
+    // about this much of L2. Chunk lengths are multiples of 16 elements, so every
+    // chunk but the last runs entirely in the vector body of a kernel, and the
+    // result does not depend on how the chunks are spread over threads.
+    const size_t PARALLEL_CHUNK_BYTES = 128 * 1024;
+
+    // f(begin, end) over disjoint subranges covering [0, n)
+    template <class F>
+    inline void parallel_for(size_t n, size_t bytes_per_element, const execution_policy &policy, F f)
+    {
+      size_t chunk = (PARALLEL_CHUNK_BYTES / bytes_per_element) & ~size_t(15);
+      chunk = chunk > 16 ? chunk : 16;
+      size_t chunks = (n + chunk - 1) / chunk;
+#ifndef JW_MATH_NO_THREADS
+      if (policy.threads != 1 && chunks > 1)
+      {
+        auto body = [&](size_t c) { f(c * chunk, c * chunk + chunk < n ? c * chunk + chunk : n); };
+        thread_pool::get().run(chunks, policy.threads, body);
+        return;
+      }
+#else
+      (void)chunks;
+      (void)policy;
+#endif
+      f(size_t(0), n);
+    }
+
+    inline void transform3(const f32 *m, const f32 *in, f32 *out, size_t n, transform_kind kind, const execution_policy &policy)
+    {
+      bool stream = policy.stream && use_stream_stores(3 * n * sizeof(f32), out);
+      parallel_for(n, 6 * sizeof(f32), policy, [&](size_t b, size_t e) {
+        dispatch().transform3(m, in + 3 * b, out + 3 * b, e - b, kind, stream);
+      });
+    }
+
+    // TRS batches: out holds n mat4s, or affine3s when affine is set. Null tx / sx
+    // leave out the translation / scale.
+    inline void trs_soa(const f32 *x, const f32 *y, const f32 *z, const f32 *w,
+                        const f32 *tx, const f32 *ty, const f32 *tz,
+                        const f32 *sx, const f32 *sy, const f32 *sz, f32 *out, size_t n, bool affine,
+                        const execution_policy &policy)
+    {
+      size_t stride = affine ? 12 : 16;
+      bool stream = policy.stream && use_stream_stores(n * stride * sizeof(f32), out);
+      parallel_for(n, (stride + 10) * sizeof(f32), policy, [&](size_t b, size_t e) {
+        const f32 *q[4] = {x + b, y + b, z + b, w + b};
+        const f32 *t[3] = {tx ? tx + b : nullptr, tx ? ty + b : nullptr, tx ? tz + b : nullptr};
+        const f32 *s[3] = {sx ? sx + b : nullptr, sx ? sy + b : nullptr, sx ? sz + b : nullptr};
+        dispatch().quat_to_mat4_soa(q, t, s, out + stride * b, e - b, affine, stream);
+      });
+    }
+
+    inline reduce3_result reduce3(const f32 *v, size_t n, void (*kernel)(const f32 *, size_t, reduce3_result &))
+    {
+      reduce3_result r = {};
+      for (int c = 0; c < 3; c++)
+      {
+        r.k[c] = n ? v[c] : 0.0F;
+        r.lo[c] = n ? v[c] : FLT_MAX;
+        r.hi[c] = n ? v[c] : -FLT_MAX;
+      }
+      kernel(v, n, r);
+      return r;
+    }
+  }
+
+  // Instruction set the batch and array kernels were selected for; log it with
+  // isa_name(). Single-object operations do not follow it (see select_isa).
+  inline isa active_isa()
+  {
+    return detail::dispatch().level;
+  }
+
+  // Output size from which execution_policy::streaming() takes effect, 1 MiB by
+  // default. Not synchronized; set it before starting batch work.
+  inline size_t stream_threshold()
+  {
+    return detail::stream_threshold_bytes();
+  }
+
+  inline void set_stream_threshold(size_t bytes)
+  {
+    detail::stream_threshold_bytes() = bytes;
+  }
+
+  struct vec2
+  {
+    f32 x, y;
+    vec2(f32 s) : x(s), y(s) {}
+    vec2(f32 x, f32 y) : x(x), y(y) {}
+
+    void print(bool print_type = true, FILE* output = stdout) const
+    {
+      if (print_type)
+        fprintf(output, "vec2\n");
+      fprintf(output, "--          --\n| %.4e |\n| %.4e |\n--          --\n", x, y);
+    }
+
+    f32 dot(const vec2 &b) const
+    {
+      return x * b.x + y * b.y;
+    }
+
+    f32 length_squared() const
+    {
+      return dot(*this);
+    }
+
+    f32 length() const
+    {
+      return sqrtf(length_squared());
+    }
+
+    // component-wise, as GLSL min() and max()
+    vec2 min(const vec2 &b) const
+    {
+      return vec2(x < b.x ? x : b.x, y < b.y ? y : b.y);
+    }
+
+    vec2 max(const vec2 &b) const
+    {
+      return vec2(x > b.x ? x : b.x, y > b.y ? y : b.y);
+    }
+
+    vec2 &normalize()
+    {
+      f32 l = length();
+      x /= l;
+      y /= l;
+      return *this;
+    }
+
+    vec2 normalized()
+    {
+      return vec2(*this).normalize();
+    }
+
+    // Faster normalize() using detail::rsqrt_fast, with a relative error below 5e-7.
+    // A zero-length vector is left at zero instead of becoming NaN.
+    vec2 &normalize_fast()
+    {
+      return *this *= detail::rsqrt_fast(length_squared());
+    }
+
+    vec2 normalized_fast() const
+    {
+      return vec2(*this).normalize_fast();
+    }
+
+    vec2 operator+(f32 s) const
+    {
+      return vec2(x + s, y + s);
+    }
+
+    vec2 operator-(f32 s) const
+    {
+      return vec2(x - s, y - s);
+    }
+
+    vec2 operator*(f32 s) const
+    {
+      return vec2(x * s, y * s);
+    }
+
+    vec2 operator/(f32 s) const
+    {
+      return vec2(x / s, y / s);
+    }
+
+    vec2 operator+(const vec2 &b) const
+    {
+      return vec2(x + b.x, y + b.y);
+    }
+
+    vec2 operator-(const vec2 &b) const
+    {
+      return vec2(x - b.x, y - b.y);
+    }
+
+    vec2 &operator+=(f32 s)
+    {
+      x += s;
+      y += s;
+      return *this;
+    }
+
+    vec2 &operator-=(f32 s)
+    {
+      x -= s;
+      y -= s;
+      return *this;
+    }
+
+    vec2 &operator*=(f32 s)
+    {
+      x *= s;
+      y *= s;
+      return *this;
+    }
+
+    vec2 &operator/=(f32 s)
+    {
+      x /= s;
+      y /= s;
+      return *this;
+    }
+
+    vec2 &operator+=(const vec2 &b)
+    {
+      return *this = *this + b;
+    }
+
+    vec2 &operator-=(const vec2 &b)
+    {
+      return *this = *this - b;
+    }
+  };
+
+  struct vec3
+  {
+    f32 x, y, z;
+    vec3(f32 s) : x(s), y(s), z(s) {}
+    vec3(f32 x, f32 y, f32 z) : x(x), y(y), z(z) {}
+    vec3(vec2 v, f32 z = 0.0F) : x(v.x), y(v.y), z(z) {}
+
+    void print(bool print_type = true, FILE* output = stdout) const
+    {
+      if (print_type)
+        fprintf(output, "vec3\n");
+      fprintf(output, "--          --\n| %.4e |\n| %.4e |\n| %.4e |\n--          --\n", x, y, z);
+    }
+
+    f32 dot(const vec3 &b) const
+    {
+      return x * b.x + y * b.y + z * b.z;
+    }
+
+    f32 length_squared() const
+    {
+      return dot(*this);
+    }
+
+    f32 length() const
+    {
+      return sqrtf(length_squared());
+    }
+
+    // component-wise, as GLSL min() and max()
+    vec3 min(const vec3 &b) const
+    {
+      return vec3(x < b.x ? x : b.x, y < b.y ? y : b.y, z < b.z ? z : b.z);
+    }
+
+    vec3 max(const vec3 &b) const
+    {
+      return vec3(x > b.x ? x : b.x, y > b.y ? y : b.y, z > b.z ? z : b.z);
+    }
+
+    vec3 &normalize()
+    {
+      f32 l = length();
+      x /= l;
+      y /= l;
+      z /= l;
+      return *this;
+    }
+
+    vec3 normalized()
+    {
+      return vec3(*this).normalize();
+    }
+
+    // Faster normalize() using detail::rsqrt_fast, with a relative error below 5e-7.
+    // A zero-length vector is left at zero instead of becoming NaN.
+    vec3 &normalize_fast()
+    {
+      return *this *= detail::rsqrt_fast(length_squared());
+    }
+
+    vec3 normalized_fast() const
+    {
+      return vec3(*this).normalize_fast();
+    }
+
+    vec3 cross(const vec3 &b)
+    {
+      return vec3(y * b.z - z * b.y, z * b.x - x * b.z, x * b.y - y * b.x);
+    }
+
+    vec3 operator+(f32 s) const
+    {
+      return vec3(x + s, y + s, z + s);
+    }
+
+    vec3 operator-(f32 s) const
+    {
+      return vec3(x - s, y - s, z - s);
+    }
+
+    vec3 operator*(f32 s) const
+    {
+      return vec3(x * s, y * s, z * s);
+    }
+
+    vec3 operator/(f32 s) const
+    {
+      return vec3(x / s, y / s, z / s);
+    }
+
+    vec3 operator+(const vec3 &b) const
+    {
+      return vec3(x + b.x, y + b.y, z + b.z);
+    }
+
+    vec3 operator-(const vec3 &b) const
+    {
+      return vec3(x - b.x, y - b.y, z - b.z);
+    }
+
+    vec3 &operator+=(f32 s)
+    {
+      x += s;
+      y += s;
+      z += s;
+      return *this;
+    }
+
+    vec3 &operator-=(f32 s)
+    {
+      x -= s;
+      y -= s;
+      z -= s;
+      return *this;
+    }
+
+    vec3 &operator*=(f32 s)
+    {
+      x *= s;
+      y *= s;
+      z *= s;
+      return *this;
+    }
+
+    vec3 &operator/=(f32 s)
+    {
+      x /= s;
+      y /= s;
+      z /= s;
+      return *this;
+    }
+
+    vec3 &operator+=(const vec3 &b)
+    {
+      return *this = *this + b;
+    }
+
+    vec3 &operator-=(const vec3 &b)
+    {
+      return *this = *this - b;
+    }
+  };
+
+  struct vec4;
+
+  // vec3 padded to 16 bytes and 16-byte aligned so that it and arrays of it can be
+  // handled with aligned SSE loads. pad is kept at zero.
+  struct alignas(16) vec3a
+  {
+    f32 x, y, z, pad;
+    vec3a(f32 s) : x(s), y(s), z(s), pad(0) {}
+    vec3a(f32 x, f32 y, f32 z) : x(x), y(y), z(z), pad(0) {}
+    vec3a(const vec3 &v) : x(v.x), y(v.y), z(v.z), pad(0) {}
+    vec3a(const vec4 &v);
+#ifdef JW_MATH_SSE2
+    vec3a(__m128 v)
+    {
+      _mm_store_ps(&x, v);
+    }
+
+    __m128 simd() const
+    {
+      return _mm_load_ps(&x);
+    }
+#endif
+
+    operator vec3() const
+    {
+      return vec3(x, y, z);
+    }
+
+    void print(bool print_type = true, FILE* output = stdout) const
+    {
+      if (print_type)
+        fprintf(output, "vec3a\n");
+      fprintf(output, "--          --\n| %.4e |\n| %.4e |\n| %.4e |\n--          --\n", x, y, z);
+    }
+
+    f32 dot(const vec3a &b) const
+    {
+#ifdef JW_MATH_SSE2
+      __m128 t = _mm_mul_ps(simd(), b.simd());
+      t = _mm_add_ss(_mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(t, t));
+      return _mm_cvtss_f32(t);
+#else
+      return x * b.x + y * b.y + z * b.z;
+#endif
+    }
+
+    f32 length_squared() const
+    {
+      return dot(*this);
+    }
+
+    f32 length() const
+    {
+#ifdef JW_MATH_SSE2
+      return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(length_squared())));
+#else
+      return sqrtf(length_squared());
+#endif
+    }
+
+    // component-wise, as GLSL min() and max()
+    vec3a min(const vec3a &b) const
+    {
+#ifdef JW_MATH_SSE2
+      return vec3a(_mm_min_ps(simd(), b.simd()));
+#else
+      return vec3a(x < b.x ? x : b.x, y < b.y ? y : b.y, z < b.z ? z : b.z);
+#endif
+    }
+
+    vec3a max(const vec3a &b) const
+    {
+#ifdef JW_MATH_SSE2
+      return vec3a(_mm_max_ps(simd(), b.simd()));
+#else
+      return vec3a(x > b.x ? x : b.x, y > b.y ? y : b.y, z > b.z ? z : b.z);
+#endif
+    }
+
+    vec3a &normalize()
+    {
+#ifdef JW_MATH_SSE2
+      f32 l = length();
+      return *this = vec3a(_mm_div_ps(simd(), _mm_setr_ps(l, l, l, 1)));
+#else
+      f32 l = length();
+      x /= l;
+      y /= l;
+      z /= l;
+      return *this;
+#endif
+    }
+
+    vec3a normalized() const
+    {
+      return vec3a(*this).normalize();
+    }
+
+    // Faster normalize() using detail::rsqrt_fast, with a relative error below 5e-7.
+    // A zero-length vector is left at zero instead of becoming NaN.
+    vec3a &normalize_fast()
+    {
+      return *this *= detail::rsqrt_fast(length_squared());
+    }
+
+    vec3a normalized_fast() const
+    {
+      return vec3a(*this).normalize_fast();
+    }
+
+    vec3a cross(const vec3a &b) const
+    {
+#ifdef JW_MATH_SSE2
+      __m128 p = simd(), q = b.simd();
+      __m128 c = _mm_sub_ps(_mm_mul_ps(p, _mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 0, 2, 1))), _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 0, 2, 1)), q));
+      return vec3a(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
+      return vec3a(y * b.z - z * b.y, z * b.x - x * b.z, x * b.y - y * b.x);
+#endif
+    }
+
+#ifdef JW_MATH_SSE2
+    vec3a operator+(f32 s) const
+    {
+      return vec3a(_mm_add_ps(simd(), _mm_setr_ps(s, s, s, 0)));
+    }
+
+    vec3a operator-(f32 s) const
+    {
+      return vec3a(_mm_sub_ps(simd(), _mm_setr_ps(s, s, s, 0)));
+    }
+
+    vec3a operator*(f32 s) const
+    {
+      return vec3a(_mm_mul_ps(simd(), _mm_setr_ps(s, s, s, 0)));
+    }
+
+    vec3a operator/(f32 s) const
+    {
+      return vec3a(_mm_div_ps(simd(), _mm_setr_ps(s, s, s, 1)));
+    }
+
+    vec3a operator+(const vec3a &b) const
+    {
+      return vec3a(_mm_add_ps(simd(), b.simd()));
+    }
+
+    vec3a operator-(const vec3a &b) const
+    {
+      return vec3a(_mm_sub_ps(simd(), b.simd()));
+    }
+#else
+    vec3a operator+(f32 s) const
+    {
+      return vec3a(x + s, y + s, z + s);
+    }
+
+    vec3a operator-(f32 s) const
+    {
+      return vec3a(x - s, y - s, z - s);
+    }
+
+    vec3a operator*(f32 s) const
+    {
+      return vec3a(x * s, y * s, z * s);
+    }
+
+    vec3a operator/(f32 s) const
+    {
+      return vec3a(x / s, y / s, z / s);
+    }
+
+    vec3a operator+(const vec3a &b) const
+    {
+      return vec3a(x + b.x, y + b.y, z + b.z);
+    }
+
+    vec3a operator-(const vec3a &b) const
+    {
+      return vec3a(x - b.x, y - b.y, z - b.z);
+    }
+#endif
+
+    vec3a &operator+=(f32 s)
+    {
+      return *this = *this + s;
+    }
+
+    vec3a &operator-=(f32 s)
+    {
+      return *this = *this - s;
+    }
+
+    vec3a &operator*=(f32 s)
+    {
+      return *this = *this * s;
+    }
+
+    vec3a &operator/=(f32 s)
+    {
+      return *this = *this / s;
+    }
+
+    vec3a &operator+=(const vec3a &b)
+    {
+      return *this = *this + b;
+    }
+
+    vec3a &operator-=(const vec3a &b)
+    {
+      return *this = *this - b;
+    }
+  };
+
+  struct JW_MATH_ALIGN16 vec4
+  {
+#ifdef JW_MATH_SIMD
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4201)
+#endif
+    union
+    {
+      JW_MATH_EXTENSION struct
+      {
+        f32 x, y, z, w;
+      };
+      __m128 v;
+    };
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+    vec4(f32 s) : v(_mm_set1_ps(s)) {}
+    vec4(f32 x, f32 y, f32 z, f32 w) : v(_mm_setr_ps(x, y, z, w)) {}
+    vec4(vec3 v, f32 w = 0.0F) : v(_mm_setr_ps(v.x, v.y, v.z, w)) {}
+    vec4(const vec3a &v, f32 w = 0.0F) : v(_mm_setr_ps(v.x, v.y, v.z, w)) {}
+    vec4(__m128 v) : v(v) {}
+#else
+    f32 x, y, z, w;
+    vec4(f32 s) : x(s), y(s), z(s), w(s) {}
+    vec4(f32 x, f32 y, f32 z, f32 w) : x(x), y(y), z(z), w(w) {}
+    vec4(vec3 v, f32 w = 0.0F) : x(v.x), y(v.y), z(v.z), w(w) {}
+    vec4(const vec3a &v, f32 w = 0.0F) : x(v.x), y(v.y), z(v.z), w(w) {}
+#endif
+
+    void print(bool print_type = true, FILE* output = stdout) const
+    {
+      if (print_type)
+        fprintf(output, "vec4\n");
+      fprintf(output, "--          --\n| %.4e |\n| %.4e |\n| %.4e |\n| %.4e |\n--          --\n", x, y, z, w);
+    }
+
+    f32 dot(const vec4 &b) const
+    {
+#ifdef JW_MATH_SIMD
+      return _mm_cvtss_f32(detail::dot4_sse2(v, b.v));
+#else
+      return x * b.x + y * b.y + z * b.z + w * b.w;
+#endif
+    }
+
+    f32 length_squared() const
+    {
+      return dot(*this);
+    }
+
+    f32 length() const
+    {
+      return sqrtf(length_squared());
+    }
+
+    // component-wise, as GLSL min() and max()
+    vec4 min(const vec4 &b) const
+    {
+#ifdef JW_MATH_SIMD
+      return vec4(_mm_min_ps(v, b.v));
+#else
+      return vec4(x < b.x ? x : b.x, y < b.y ? y : b.y, z < b.z ? z : b.z, w < b.w ? w : b.w);
+#endif
+    }
+
+    vec4 max(const vec4 &b) const
+    {
+#ifdef JW_MATH_SIMD
+      return vec4(_mm_max_ps(v, b.v));
+#else
+      return vec4(x > b.x ? x : b.x, y > b.y ? y : b.y, z > b.z ? z : b.z, w > b.w ? w : b.w);
+#endif
+    }
+
+    vec4 &normalize()
+    {
+#ifdef JW_MATH_SIMD
+      v = _mm_div_ps(v, _mm_sqrt_ps(detail::dot4_sse2(v, v)));
+#else
+      f32 l = length();
+      x /= l;
+      y /= l;
+      z /= l;
+      w /= l;
+#endif
+      return *this;
+    }
+
+    vec4 normalized()
+    {
+      return vec4(*this).normalize();
+    }
+
+    // Faster normalize() using detail::rsqrt_fast, with a relative error below 5e-7.
+    // A zero-length vector is left at zero instead of becoming NaN.
+    vec4 &normalize_fast()
+    {
+#ifdef JW_MATH_SIMD
+      v = _mm_mul_ps(v, detail::rsqrt_nr_sse2(detail::dot4_sse2(v, v)));
+      return *this;
+#else
+      return *this *= detail::rsqrt_fast(length_squared());
+#endif
+    }
+
+    vec4 normalized_fast() const
+    {
+      return vec4(*this).normalize_fast();
+    }
+
+#ifdef JW_MATH_SIMD
+    vec4 operator+(f32 s) const
+    {
+      return vec4(_mm_add_ps(v, _mm_set1_ps(s)));
+    }
+
+    vec4 operator-(f32 s) const
+    {
+      return vec4(_mm_sub_ps(v, _mm_set1_ps(s)));
+    }
+
+    vec4 operator*(f32 s) const
+    {
+      return vec4(_mm_mul_ps(v, _mm_set1_ps(s)));
+    }
+
+    vec4 operator/(f32 s) const
+    {
+      return vec4(_mm_div_ps(v, _mm_set1_ps(s)));
+    }
+
+    vec4 operator+(const vec4 &b) const
+    {
+      return vec4(_mm_add_ps(v, b.v));
+    }
+
+    vec4 operator-(const vec4 &b) const
+    {
+      return vec4(_mm_sub_ps(v, b.v));
+    }
+#else
+    vec4 operator+(f32 s) const
+    {
+      return vec4(x + s, y + s, z + s, w + s);
+    }
+
+    vec4 operator-(f32 s) const
+    {
+      return vec4(x - s, y - s, z - s, w - s);
+    }
+
+    vec4 operator*(f32 s) const
+    {
+      return vec4(x * s, y * s, z * s, w * s);
+    }
+
+    vec4 operator/(f32 s) const
+    {
+      return vec4(x / s, y / s, z / s, w / s);
+    }
+
+    vec4 operator+(const vec4 &b) const
+    {
+      return vec4(x + b.x, y + b.y, z + b.z, w + b.w);
+    }
+
+    vec4 operator-(const vec4 &b) const
+    {
+      return vec4(x - b.x, y - b.y, z - b.z, w - b.w);
+    }
+#endif
+
+    vec4 &operator+=(f32 s)
+    {
+      return *this = *this + s;
+    }
+
+    vec4 &operator-=(f32 s)
+    {
+      return *this = *this - s;
+    }
+
+    vec4 &operator*=(f32 s)
+    {
+      return *this = *this * s;
+    }
+
+    vec4 &operator/=(f32 s)
+    {
+      return *this = *this / s;
+    }
+
+    vec4 &operator+=(const vec4 &b)
+    {
+      return *this = *this + b;
+    }
+
+    vec4 &operator-=(const vec4 &b)
+    {
+      return *this = *this - b;
+    }
+  };
+
+  inline vec3a::vec3a(const vec4 &v) : x(v.x), y(v.y), z(v.z), pad(0) {}
+
+  struct JW_MATH_ALIGN16 quat
+  {
+#ifdef JW_MATH_SIMD
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4201)
+#endif
+    union
+    {
+      JW_MATH_EXTENSION struct
+      {
+        f32 x, y, z, w;
+      };
+      __m128 v;
+    };
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+    quat(f32 x, f32 y, f32 z, f32 w) : v(_mm_setr_ps(x, y, z, w)) {}
+    quat(vec3 axis, f32 angle) : v(_mm_mul_ps(_mm_setr_ps(axis.x, axis.y, axis.z, 1.0F), _mm_setr_ps(sinf(angle / 2), sinf(angle / 2), sinf(angle / 2), cosf(angle / 2)))) {}
+    quat(__m128 v) : v(v) {}
+#else
+    f32 x, y, z, w;
+    quat(f32 x, f32 y, f32 z, f32 w) : x(x), y(y), z(z), w(w) {}
+    quat(vec3 axis, f32 angle) : x(axis.x * sinf(angle / 2)), y(axis.y * sinf(angle / 2)), z(axis.z * sinf(angle / 2)), w(cosf(angle / 2)) {}
+#endif
+  };
+
+  struct mat4
+  {
+    f32 m00 = 0, m01 = 0, m02 = 0, m03 = 0,
+        m10 = 0, m11 = 0, m12 = 0, m13 = 0,
+        m20 = 0, m21 = 0, m22 = 0, m23 = 0,
+        m30 = 0, m31 = 0, m32 = 0, m33 = 0;
+    mat4(f32 s = 1.0F) : m00(s), m11(s), m22(s), m33(s) {}
+    mat4(const quat &q)
+    {
+#ifdef JW_MATH_SSE2
+      detail::quat_to_mat4_sse2(&q.x, data());
+#else
+      detail::quat_to_mat4_scalar(&q.x, data());
+#endif
+    }
+
+    void print(bool print_type = true, FILE* output = stdout) const
+    {
+      if (print_type)
+        fprintf(output, "mat4\n");
+
+      fprintf(output, "--                                               --\n");
+      fprintf(output, "| %+.4e %+.4e %+.4e %+.4e |\n", m00, m10, m20, m30);
+      fprintf(output, "| %+.4e %+.4e %+.4e %+.4e |\n", m01, m11, m21, m31);
+      fprintf(output, "| %+.4e %+.4e %+.4e %+.4e |\n", m02, m12, m22, m32);
+      fprintf(output, "| %+.4e %+.4e %+.4e %+.4e |\n", m03, m13, m23, m33);
+      fprintf(output, "--                                               --\n");
+    }
+
+    f32 *data()
+    {
+      return &m00;
+    }
+
+    // true if the bottom row is (0, 0, 0, 1)
+    bool is_affine() const
+    {
+      return m03 == 0 && m13 == 0 && m23 == 0 && m33 == 1;
+    }
+
+    const f32 *data() const
+    {
+      return &m00;
+    }
+
+    // translate, scale and rotate right-multiply by the corresponding transform,
+    // touching only the columns it changes. The results compare equal to those of
+    // the full product by a mat4 built from the transform; only the sign of an
+    // exact zero may differ, as the skipped terms are all +-0.
+    mat4 &translate(const vec3 &xyz)
+    {
+      f32 t[4] = {xyz.x, xyz.y, xyz.z, 0.0F};
+      detail::mat4_mul_columns3(data(), t, t, 1);
+      m30 += t[0];
+      m31 += t[1];
+      m32 += t[2];
+      m33 += t[3];
+      return *this;
+    }
+
+    mat4 translated(const vec3 &xyz) const
+    {
+      mat4 r = *this;
+      return r.translate(xyz);
+    }
+
+    mat4 &scale(const vec3 &s)
+    {
+      f32 *m = data();
+      for (int i = 0; i < 4; i++)
+      {
+        m[i] *= s.x;
+        m[4 + i] *= s.y;
+        m[8 + i] *= s.z;
+      }
+      return *this;
+    }
+
+    mat4 scaled(const vec3 &s) const
+    {
+      mat4 r = *this;
+      return r.scale(s);
+    }
+
+    mat4 &rotate(const vec3 &axis, f32 angle)
+    {
+      return rotate(quat(axis, angle));
+    }
+
+    mat4 rotated(const vec3 &axis, f32 angle) const
+    {
+      mat4 r = *this;
+      return r.rotate(axis, angle);
+    }
+
+    mat4 &rotate(const quat &q)
+    {
+      mat4 t(q);
+      detail::mat4_mul_columns3(data(), t.data(), data(), 3);
+      return *this;
+    }
+
+    mat4 rotated(const quat &q) const
+    {
+      mat4 r = *this;
+      return r.rotate(q);
+    }
+
+    // Inverts in place and returns the determinant. A singular matrix (determinant
+    // zero or subnormal) is left unchanged and 0 is returned, so no inf or NaN is
+    // ever produced.
+    f32 inverse()
+    {
+      return detail::dispatch().mat4_inverse(data(), data());
+    }
+
+    // The inverse, or an unchanged copy if singular; the determinant as returned by
+    // inverse() is stored to *det when det is not null.
+    mat4 inverted(f32 *det = nullptr) const
+    {
+      mat4 r = *this;
+      f32 d = r.inverse();
+      if (det)
+        *det = d;
+      return r;
+    }
+
+    // Cheaper inverses for affine matrices (last row 0 0 0 1, checked by a debug
+    // assertion), as built by translate, rotate and scale. inverse_affine inverts
+    // the 3x3 block and returns its determinant, treating singularity as inverse()
+    // does.
+    f32 inverse_affine()
+    {
+      JW_MATH_ASSERT(is_affine());
+      return detail::mat4_inverse_affine(data(), data());
+    }
+
+    mat4 inverted_affine(f32 *det = nullptr) const
+    {
+      mat4 r = *this;
+      f32 d = r.inverse_affine();
+      if (det)
+        *det = d;
+      return r;
+    }
+
+    // inverse_rigid additionally requires an orthonormal 3x3 block (rotation or
+    // reflection, no scale), e.g. a camera's view matrix, and only transposes it.
+    mat4 &inverse_rigid()
+    {
+      JW_MATH_ASSERT(is_affine() && detail::is_orthonormal3(data(), 1e-4F));
+      detail::mat4_inverse_rigid(data(), data());
+      return *this;
+    }
+
+    mat4 inverted_rigid() const
+    {
+      mat4 r = *this;
+      return r.inverse_rigid();
+    }
+
+    // Single products are inlined rather than dispatched: an indirect call costs
+    // more than the 16 multiply-adds, and SSE2 is always available on x86-64.
+    // They are no faster than the scalar code a compiler vectorizes at -O2; for
+    // throughput, multiply many matrices at once with mul() or mul_mvp().
+    mat4 operator*(const mat4 &b) const
+    {
+      mat4 r;
+#ifdef JW_MATH_SSE2
+      detail::mat4_mul_sse2(data(), b.data(), r.data());
+#else
+      detail::mat4_mul_scalar(data(), b.data(), r.data());
+#endif
+      return r;
+    }
+
+    vec4 operator*(const vec4 &b) const
+    {
+      vec4 r(0.0F);
+#ifdef JW_MATH_SSE2
+      detail::mat4_mul_vec4_sse2(data(), &b.x, &r.x);
+#else
+      detail::mat4_mul_vec4_scalar(data(), &b.x, &r.x);
+#endif
+      return r;
+    }
+
+    mat4 &operator*=(const mat4 &b)
+    {
+      return *this = *this * b;
+    }
+
+    // mat4().translate(t).rotate(r).scale(s), written directly: the rotation's
+    // columns scaled by s, with t as the translation
+    static mat4 from_trs(const vec3 &t, const quat &r, const vec3 &s)
+    {
+      mat4 m(r);
+      m.m00 *= s.x;
+      m.m01 *= s.x;
+      m.m02 *= s.x;
+      m.m10 *= s.y;
+      m.m11 *= s.y;
+      m.m12 *= s.y;
+      m.m20 *= s.z;
+      m.m21 *= s.z;
+      m.m22 *= s.z;
+      m.m30 = t.x;
+      m.m31 = t.y;
+      m.m32 = t.z;
+      return m;
+    }
+
+    static mat4 perspective(f32 fovy, f32 ar, f32 n, f32 f)
+    {
+      mat4 result;
+
+      f32 ht = tanf(fovy / 2.0F);
+      f32 t = n * ht;
+      f32 r = t * ar;
+
+      result.m00 = n / r;
+      result.m11 = n / t;
+      result.m22 = -(f + n) / (f - n);
+      result.m23 = -1.0F;
+      result.m32 = -(2.0F * n * f) / (f - n);
+      result.m33 = 0.0F;
+
+      return result;
+    }
+  };
+
+  // Affine transform stored as the top three rows of a mat4: four column-major
+  // columns of three floats, the last being the translation, with an implied bottom
+  // row of (0, 0, 0, 1). 25% smaller than mat4, and composing two takes 36
+  // multiplies instead of 64.
+  struct affine3
+  {
+    f32 m00 = 0, m01 = 0, m02 = 0,
+        m10 = 0, m11 = 0, m12 = 0,
+        m20 = 0, m21 = 0, m22 = 0,
+        m30 = 0, m31 = 0, m32 = 0;
+    affine3(f32 s = 1.0F) : m00(s), m11(s), m22(s) {}
+
+    // drops the bottom row, which must be (0, 0, 0, 1)
+    explicit affine3(const mat4 &m)
+    {
+      JW_MATH_ASSERT(m.is_affine());
+      for (int c = 0; c < 4; c++)
+        memcpy(data() + 3 * c, m.data() + 4 * c, 3 * sizeof(f32));
+    }
+
+    void print(bool print_type = true, FILE* output = stdout) const
+    {
+      if (print_type)
+        fprintf(output, "affine3\n");
 
       fprintf(output, "--                                               --\n");
       fprintf(output, "| %+.4e %+.4e %+.4e %+.4e |\n", m00, m10, m20, m30);
       fprintf(output, "| %+.4e %+.4e %+.4e %+.4e |\n", m01, m11, m21, m31);
       fprintf(output, "| %+.4e %+.4e %+.4e %+.4e |\n", m02, m12, m22, m32);
-      fprintf(output, "| %+.4e %+.4e %+.4e %+.4e |\n", m03, m13, m23, m33);
       fprintf(output, "--                                               --\n");
     }
 
-    f32 *data()
+    f32 *data()
+    {
+      return &m00;
+    }
+
+    const f32 *data() const
+    {
+      return &m00;
+    }
+
+    static affine3 from_trs(const vec3 &t, const quat &r, const vec3 &s)
+    {
+      return affine3(mat4::from_trs(t, r, s));
+    }
+
+    mat4 to_mat4() const
+    {
+      mat4 r;
+      for (int c = 0; c < 4; c++)
+        memcpy(r.data() + 4 * c, data() + 3 * c, 3 * sizeof(f32));
+      return r;
+    }
+
+    // (m * vec4(p, 1)).xyz
+    vec3 transform_point(const vec3 &p) const
+    {
+      return vec3(m00 * p.x + m10 * p.y + m20 * p.z + m30,
+                  m01 * p.x + m11 * p.y + m21 * p.z + m31,
+                  m02 * p.x + m12 * p.y + m22 * p.z + m32);
+    }
+
+    // (m * vec4(v, 0)).xyz
+    vec3 transform_vector(const vec3 &v) const
+    {
+      return vec3(m00 * v.x + m10 * v.y + m20 * v.z,
+                  m01 * v.x + m11 * v.y + m21 * v.z,
+                  m02 * v.x + m12 * v.y + m22 * v.z);
+    }
+
+    affine3 operator*(const affine3 &b) const
+    {
+      affine3 r;
+#ifdef JW_MATH_SSE2
+      detail::affine3_mul_sse2(data(), b.data(), r.data());
+#else
+      detail::affine3_mul_scalar(data(), b.data(), r.data());
+#endif
+      return r;
+    }
+
+    affine3 &operator*=(const affine3 &b)
+    {
+      return *this = *this * b;
+    }
+  };
+
+  // 3x3 matrix in the column-major layout of mat4, for rotations and normal
+  // matrices
+  struct mat3
+  {
+    f32 m00 = 0, m01 = 0, m02 = 0,
+        m10 = 0, m11 = 0, m12 = 0,
+        m20 = 0, m21 = 0, m22 = 0;
+    mat3(f32 s = 1.0F) : m00(s), m11(s), m22(s) {}
+    mat3(const quat &q) : mat3(mat4(q)) {}
+
+    // upper-left 3x3 block
+    explicit mat3(const mat4 &m)
+    {
+      for (int c = 0; c < 3; c++)
+        memcpy(data() + 3 * c, m.data() + 4 * c, 3 * sizeof(f32));
+    }
+
+    void print(bool print_type = true, FILE* output = stdout) const
+    {
+      if (print_type)
+        fprintf(output, "mat3\n");
+
+      fprintf(output, "--                                  --\n");
+      fprintf(output, "| %+.4e %+.4e %+.4e |\n", m00, m10, m20);
+      fprintf(output, "| %+.4e %+.4e %+.4e |\n", m01, m11, m21);
+      fprintf(output, "| %+.4e %+.4e %+.4e |\n", m02, m12, m22);
+      fprintf(output, "--                                  --\n");
+    }
+
+    f32 *data()
+    {
+      return &m00;
+    }
+
+    const f32 *data() const
+    {
+      return &m00;
+    }
+
+    mat4 to_mat4() const
+    {
+      mat4 r;
+      for (int c = 0; c < 3; c++)
+        memcpy(r.data() + 4 * c, data() + 3 * c, 3 * sizeof(f32));
+      return r;
+    }
+
+    f32 determinant() const
+    {
+      f32 c[9];
+      return detail::mat3_cofactors(data(), c);
+    }
+
+    mat3 &transpose()
+    {
+      f32 t = m01;
+      m01 = m10;
+      m10 = t;
+      t = m02;
+      m02 = m20;
+      m20 = t;
+      t = m12;
+      m12 = m21;
+      m21 = t;
+      return *this;
+    }
+
+    mat3 transposed() const
+    {
+      mat3 r = *this;
+      return r.transpose();
+    }
+
+    // As mat4::inverse: returns the determinant, leaving a singular matrix unchanged
+    // and returning 0.
+    f32 inverse()
+    {
+      return detail::mat3_inverse(data(), data());
+    }
+
+    mat3 inverted(f32 *det = nullptr) const
+    {
+      mat3 r = *this;
+      f32 d = r.inverse();
+      if (det)
+        *det = d;
+      return r;
+    }
+
+    mat3 operator*(const mat3 &b) const
+    {
+      mat3 r;
+#ifdef JW_MATH_SSE2
+      detail::mat3_mul_sse2(data(), b.data(), r.data());
+#else
+      detail::mat3_mul_scalar(data(), b.data(), r.data());
+#endif
+      return r;
+    }
+
+    vec3 operator*(const vec3 &v) const
+    {
+      return vec3(m00 * v.x + m10 * v.y + m20 * v.z,
+                  m01 * v.x + m11 * v.y + m21 * v.z,
+                  m02 * v.x + m12 * v.y + m22 * v.z);
+    }
+
+    mat3 &operator*=(const mat3 &b)
+    {
+      return *this = *this * b;
+    }
+  };
+
+  static_assert(sizeof(vec2) == 2 * sizeof(f32), "vec2 must be 2 tightly packed floats");
+  static_assert(sizeof(vec3) == 3 * sizeof(f32), "vec3 must be 3 tightly packed floats");
+  static_assert(sizeof(vec3a) == 4 * sizeof(f32), "vec3a must be 4 tightly packed floats");
+  static_assert(sizeof(vec4) == 4 * sizeof(f32), "vec4 must be 4 tightly packed floats");
+  static_assert(sizeof(mat4) == 16 * sizeof(f32), "mat4 must be 16 tightly packed floats");
+  static_assert(sizeof(affine3) == 12 * sizeof(f32), "affine3 must be 12 tightly packed floats");
+  static_assert(sizeof(mat3) == 9 * sizeof(f32), "mat3 must be 9 tightly packed floats");
+
+  // out[i] = a[i] * b[i] for every i < n; out may alias a or b
+  inline void mul(const mat4 *a, const mat4 *b, mat4 *out, size_t n)
+  {
+    detail::dispatch().mat4_mul_batch(reinterpret_cast<const f32 *>(a), reinterpret_cast<const f32 *>(b), reinterpret_cast<f32 *>(out), n);
+  }
+
+  inline void mul(const affine3 *a, const affine3 *b, affine3 *out, size_t n)
+  {
+    detail::dispatch().affine3_mul_batch(reinterpret_cast<const f32 *>(a), reinterpret_cast<const f32 *>(b), reinterpret_cast<f32 *>(out), n);
+  }
+
+  inline void mul(const mat3 *a, const mat3 *b, mat3 *out, size_t n)
+  {
+    detail::dispatch().mat3_mul_batch(reinterpret_cast<const f32 *>(a), reinterpret_cast<const f32 *>(b), reinterpret_cast<f32 *>(out), n);
+  }
+
+  // Normal matrix of m: the inverse-transpose of its upper-left 3x3 block, or the
+  // block's cofactor matrix if it is singular by mat3::inverse's test (still usable
+  // for normals, which get renormalized). The batch form computes out[i] for m[i].
+  inline void normal_matrix(const mat4 *m, mat3 *out, size_t n)
+  {
+    detail::dispatch().normal_matrix3_batch(reinterpret_cast<const f32 *>(m), reinterpret_cast<f32 *>(out), n);
+  }
+
+  inline mat3 normal_matrix(const mat4 &m)
+  {
+    mat3 r;
+    normal_matrix(&m, &r, 1);
+    return r;
+  }
+
+  // out[i] = in[i].inverted(det ? &det[i] : nullptr) for n matrices; out may
+  // alias in. Returns the number of singular matrices.
+  inline size_t inverse(const mat4 *in, mat4 *out, size_t n, f32 *det = nullptr)
+  {
+    return detail::dispatch().mat4_inverse_batch(reinterpret_cast<const f32 *>(in), reinterpret_cast<f32 *>(out), det, n);
+  }
+
+  // mvp[i] = vp * model[i] for n instances, with vp held in registers; mvp may alias
+  // model.
+  inline void mul_mvp(const mat4 &vp, const mat4 *model, mat4 *mvp, size_t n, const execution_policy &policy = seq)
+  {
+    bool stream = policy.stream && detail::use_stream_stores(n * sizeof(mat4), mvp);
+    detail::parallel_for(n, 2 * sizeof(mat4), policy, [&](size_t b, size_t e) {
+      detail::dispatch().mvp_batch(vp.data(), nullptr, reinterpret_cast<const f32 *>(model + b), reinterpret_cast<f32 *>(mvp + b), nullptr, nullptr, e - b, stream);
+    });
+  }
+
+  // As above with vp = proj * view, also writing mv[i] = view * model[i] and the
+  // normal matrix nrm[i] (inverse-transpose of mv[i]'s upper-left 3x3, identity
+  // elsewhere) in the same pass when they are not null.
+  inline void mul_mvp(const mat4 &proj, const mat4 &view, const mat4 *model, mat4 *mvp, mat4 *mv, mat4 *nrm, size_t n,
+                      const execution_policy &policy = seq)
+  {
+    mat4 vp = proj * view;
+    size_t outputs = 1 + !!mv + !!nrm;
+    bool stream = policy.stream && detail::use_stream_stores(n * sizeof(mat4) * outputs, mvp, mv, nrm);
+    detail::parallel_for(n, sizeof(mat4) * (1 + outputs), policy, [&](size_t b, size_t e) {
+      detail::dispatch().mvp_batch(vp.data(), view.data(), reinterpret_cast<const f32 *>(model + b), reinterpret_cast<f32 *>(mvp + b),
+                                   mv ? reinterpret_cast<f32 *>(mv + b) : nullptr, nrm ? reinterpret_cast<f32 *>(nrm + b) : nullptr, e - b, stream);
+    });
+  }
+
+  // (ox, oy, oz)[i] = (m * vec4(x[i], y[i], z[i], 1)).xyz for points stored as separate
+  // coordinate arrays; the outputs may be the input arrays
+  inline void transform_soa(const mat4 &m, const f32 *x, const f32 *y, const f32 *z, f32 *ox, f32 *oy, f32 *oz, size_t n,
+                            const execution_policy &policy = seq)
+  {
+    bool stream = policy.stream && detail::use_stream_stores(3 * n * sizeof(f32), ox, oy, oz);
+    detail::parallel_for(n, 6 * sizeof(f32), policy, [&](size_t b, size_t e) {
+      const f32 *in[4] = {x + b, y + b, z + b, nullptr};
+      f32 *out[4] = {ox + b, oy + b, oz + b, nullptr};
+      detail::dispatch().transform_soa(m.data(), in, out, e - b, stream);
+    });
+  }
+
+  // (ox, oy, oz, ow)[i] = m * vec4(x[i], y[i], z[i], w[i])
+  inline void transform_soa(const mat4 &m, const f32 *x, const f32 *y, const f32 *z, const f32 *w, f32 *ox, f32 *oy, f32 *oz, f32 *ow, size_t n,
+                            const execution_policy &policy = seq)
+  {
+    bool stream = policy.stream && detail::use_stream_stores(4 * n * sizeof(f32), ox, oy, oz, ow);
+    detail::parallel_for(n, 8 * sizeof(f32), policy, [&](size_t b, size_t e) {
+      const f32 *in[4] = {x + b, y + b, z + b, w + b};
+      f32 *out[4] = {ox + b, oy + b, oz + b, ow + b};
+      detail::dispatch().transform_soa(m.data(), in, out, e - b, stream);
+    });
+  }
+
+  // out[i] = (m * vec4(in[i], 1)).xyz / w. The divide is skipped when m is affine,
+  // where it would be by one. out may be in, but must not otherwise overlap it.
+  inline void transform_points(const mat4 &m, const vec3 *in, vec3 *out, size_t n, const execution_policy &policy = seq)
+  {
+    detail::transform_kind kind = m.is_affine() ? detail::transform_kind::affine_point : detail::transform_kind::point;
+    detail::transform3(m.data(), reinterpret_cast<const f32 *>(in), reinterpret_cast<f32 *>(out), n, kind, policy);
+  }
+
+  inline void transform_points(const mat4 &m, vec3 *points, size_t n, const execution_policy &policy = seq)
+  {
+    transform_points(m, points, points, n, policy);
+  }
+
+  // out[i] = (m * vec4(in[i], 0)).xyz, i.e. without translation
+  inline void transform_vectors(const mat4 &m, const vec3 *in, vec3 *out, size_t n, const execution_policy &policy = seq)
+  {
+    detail::transform3(m.data(), reinterpret_cast<const f32 *>(in), reinterpret_cast<f32 *>(out), n, detail::transform_kind::vector, policy);
+  }
+
+  inline void transform_vectors(const mat4 &m, vec3 *vectors, size_t n, const execution_policy &policy = seq)
+  {
+    transform_vectors(m, vectors, vectors, n, policy);
+  }
+
+  // The same on the compact representation, through the affine mat4 kernels
+  inline void transform_points(const affine3 &m, const vec3 *in, vec3 *out, size_t n, const execution_policy &policy = seq)
+  {
+    detail::transform3(m.to_mat4().data(), reinterpret_cast<const f32 *>(in), reinterpret_cast<f32 *>(out), n, detail::transform_kind::affine_point, policy);
+  }
+
+  inline void transform_vectors(const affine3 &m, const vec3 *in, vec3 *out, size_t n, const execution_policy &policy = seq)
+  {
+    detail::transform3(m.to_mat4().data(), reinterpret_cast<const f32 *>(in), reinterpret_cast<f32 *>(out), n, detail::transform_kind::vector, policy);
+  }
+
+  // out[i] = normalize(inverse(transpose(m3)) * in[i]) for the upper-left 3x3 block
+  // m3 of m. The inverse-transpose is computed once per call, and skipped when m3 is
+  // a rotation times a uniform scale, since it is then parallel to m3 itself.
+  inline void transform_normals(const mat4 &m, const vec3 *in, vec3 *out, size_t n, const execution_policy &policy = seq)
+  {
+    f32 r[16] = {0};
+    if (detail::is_conformal3(m.data()))
+      memcpy(r, m.data(), sizeof(r));
+    else
+      detail::inverse_transpose3(m.data(), r);
+    detail::transform3(r, reinterpret_cast<const f32 *>(in), reinterpret_cast<f32 *>(out), n, detail::transform_kind::normal, policy);
+  }
+
+  inline void transform_normals(const mat4 &m, vec3 *normals, size_t n, const execution_policy &policy = seq)
+  {
+    transform_normals(m, normals, normals, n, policy);
+  }
+
+  // out[i] = mat4().translate(t[i]).rotate(q[i]).scale(s[i]) in a single pass
+  inline void quat_to_mat4_soa(const f32 *x, const f32 *y, const f32 *z, const f32 *w,
+                               const f32 *tx, const f32 *ty, const f32 *tz,
+                               const f32 *sx, const f32 *sy, const f32 *sz, mat4 *out, size_t n,
+                               const execution_policy &policy = seq)
+  {
+    detail::trs_soa(x, y, z, w, tx, ty, tz, sx, sy, sz, reinterpret_cast<f32 *>(out), n, false, policy);
+  }
+
+  // The same written as affine3s, e.g. for instancing buffers
+  inline void quat_to_affine3_soa(const f32 *x, const f32 *y, const f32 *z, const f32 *w,
+                                  const f32 *tx, const f32 *ty, const f32 *tz,
+                                  const f32 *sx, const f32 *sy, const f32 *sz, affine3 *out, size_t n,
+                                  const execution_policy &policy = seq)
+  {
+    detail::trs_soa(x, y, z, w, tx, ty, tz, sx, sy, sz, reinterpret_cast<f32 *>(out), n, true, policy);
+  }
+
+  // out[i] = mat4(quat(x[i], y[i], z[i], w[i])) for quats stored as separate arrays
+  inline void quat_to_mat4_soa(const f32 *x, const f32 *y, const f32 *z, const f32 *w, mat4 *out, size_t n,
+                               const execution_policy &policy = seq)
+  {
+    quat_to_mat4_soa(x, y, z, w, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, out, n, policy);
+  }
+
+  inline void normalize(vec3 *v, size_t n, const execution_policy &policy = seq)
+  {
+    detail::parallel_for(n, 2 * sizeof(vec3), policy, [&](size_t b, size_t e) {
+      detail::dispatch().normalize3(reinterpret_cast<f32 *>(v + b), e - b);
+    });
+  }
+
+  inline void normalize(vec4 *v, size_t n, const execution_policy &policy = seq)
+  {
+    detail::parallel_for(n, 2 * sizeof(vec4), policy, [&](size_t b, size_t e) {
+      detail::dispatch().normalize4(reinterpret_cast<f32 *>(v + b), e - b);
+    });
+  }
+
+  // Batch normalize_fast(); zero-length vectors stay zero.
+  inline void normalize_fast(vec2 *v, size_t n, const execution_policy &policy = seq)
+  {
+    detail::parallel_for(n, 2 * sizeof(vec2), policy, [&](size_t b, size_t e) {
+      detail::dispatch().normalize2_fast(reinterpret_cast<f32 *>(v + b), e - b);
+    });
+  }
+
+  inline void normalize_fast(vec3 *v, size_t n, const execution_policy &policy = seq)
+  {
+    detail::parallel_for(n, 2 * sizeof(vec3), policy, [&](size_t b, size_t e) {
+      detail::dispatch().normalize3_fast(reinterpret_cast<f32 *>(v + b), e - b);
+    });
+  }
+
+  inline void normalize_fast(vec4 *v, size_t n, const execution_policy &policy = seq)
+  {
+    detail::parallel_for(n, 2 * sizeof(vec4), policy, [&](size_t b, size_t e) {
+      detail::dispatch().normalize4_fast(reinterpret_cast<f32 *>(v + b), e - b);
+    });
+  }
+
+  // Batched dot products: one vector against an array (1-vs-N) or two arrays
+  // element by element (N-vs-N), out[i] = dot(a, b[i]) or dot(a[i], b[i]).
+  inline void dot(const vec3 &a, const vec3 *b, f32 *out, size_t n)
+  {
+    detail::dispatch().dot3_one(&a.x, reinterpret_cast<const f32 *>(b), out, n, 0.0F);
+  }
+
+  inline void dot(const vec3 *a, const vec3 *b, f32 *out, size_t n)
+  {
+    detail::dispatch().dot3(reinterpret_cast<const f32 *>(a), reinterpret_cast<const f32 *>(b), out, n, 0.0F);
+  }
+
+  inline void dot(const vec4 &a, const vec4 *b, f32 *out, size_t n)
+  {
+    detail::dispatch().dot4_one(&a.x, reinterpret_cast<const f32 *>(b), out, n);
+  }
+
+  inline void dot(const vec4 *a, const vec4 *b, f32 *out, size_t n)
+  {
+    detail::dispatch().dot4(reinterpret_cast<const f32 *>(a), reinterpret_cast<const f32 *>(b), out, n);
+  }
+
+  // The same over SoA streams; for two SoA arrays see vec3_soa::dot and vec4_soa::dot.
+  inline void dot(const vec3 &a, const f32 *x, const f32 *y, const f32 *z, f32 *out, size_t n)
+  {
+    const f32 c[4] = {a.x, a.y, a.z, 0.0F};
+    const f32 *b[4] = {x, y, z, nullptr};
+    detail::dispatch().dot_soa_one(c, b, out, n);
+  }
+
+  inline void dot(const vec4 &a, const f32 *x, const f32 *y, const f32 *z, const f32 *w, f32 *out, size_t n)
+  {
+    const f32 c[4] = {a.x, a.y, a.z, a.w};
+    const f32 *b[4] = {x, y, z, w};
+    detail::dispatch().dot_soa_one(c, b, out, n);
+  }
+
+  // out[i] = dot(plane, vec4(points[i], 1)), the signed distance from the plane
+  // (a, b, c, d) with ax + by + cz + d = 0 when (a, b, c) is unit length
+  inline void plane_distance(const vec4 &plane, const vec3 *points, f32 *out, size_t n)
+  {
+    detail::dispatch().dot3_one(&plane.x, reinterpret_cast<const f32 *>(points), out, n, plane.w);
+  }
+
+  inline void plane_distance(const vec4 &plane, const f32 *x, const f32 *y, const f32 *z, f32 *out, size_t n)
+  {
+    const f32 c[4] = {plane.x, plane.y, plane.z, plane.w};
+    const f32 *b[4] = {x, y, z, nullptr};
+    detail::dispatch().dot_soa_one(c, b, out, n);
+  }
+
+  // Classifies points against a plane as in front (distance > epsilon), behind
+  // (distance < -epsilon) or on it, setting bit i % 32 of word i / 32 in the
+  // matching mask and clearing it in the others. Each mask is optional and
+  // otherwise holds (n + 31) / 32 words. NaN distances count as on the plane.
+  inline void classify(const vec4 &plane, const vec3 *points, size_t n, f32 epsilon, u32 *front, u32 *back, u32 *on = nullptr)
+  {
+    f32 d[256];
+    for (size_t i = 0; i < n; i += 256)
+    {
+      size_t m = n - i < 256 ? n - i : 256;
+      u32 *masks[3] = {front ? front + i / 32 : nullptr, back ? back + i / 32 : nullptr, on ? on + i / 32 : nullptr};
+      plane_distance(plane, points + i, d, m);
+      detail::dispatch().classify(d, m, epsilon, masks);
+    }
+  }
+
+  inline void classify(const vec4 &plane, const f32 *x, const f32 *y, const f32 *z, size_t n, f32 epsilon, u32 *front, u32 *back, u32 *on = nullptr)
+  {
+    f32 d[256];
+    for (size_t i = 0; i < n; i += 256)
     {
-      return &m00;
+      size_t m = n - i < 256 ? n - i : 256;
+      u32 *masks[3] = {front ? front + i / 32 : nullptr, back ? back + i / 32 : nullptr, on ? on + i / 32 : nullptr};
+      plane_distance(plane, x + i, y + i, z + i, d, m);
+      detail::dispatch().classify(d, m, epsilon, masks);
     }
+  }
 
-    const f32 *data() const
+  // Axis-aligned box; min > max on some axis means empty
+  struct aabb
+  {
+    vec3 min, max;
+    aabb(const vec3 &min, const vec3 &max) : min(min), max(max) {}
+  };
+
+  // Bounds of n points, empty for n = 0
+  inline aabb bounds(const vec3 *v, size_t n)
+  {
+    detail::reduce3_result r = detail::reduce3(reinterpret_cast<const f32 *>(v), n, detail::dispatch().bounds3);
+    return aabb(vec3(r.lo[0], r.lo[1], r.lo[2]), vec3(r.hi[0], r.hi[1], r.hi[2]));
+  }
+
+  // Mean of n points, zero for n = 0
+  inline vec3 centroid(const vec3 *v, size_t n)
+  {
+    detail::reduce3_result r = detail::reduce3(reinterpret_cast<const f32 *>(v), n, detail::dispatch().sum3);
+    f64 d = n ? (f64)n : 1.0;
+    return vec3((f32)(r.k[0] + r.s[0] / d), (f32)(r.k[1] + r.s[1] / d), (f32)(r.k[2] + r.s[2] / d));
+  }
+
+  // Bounds, centroid and population covariance 1/n sum (p - c)(p - c)^T of a point
+  // set, e.g. for fitting an oriented box to the covariance's eigenvectors.
+  // covariance[i][j] is the covariance of components i and j, so it is symmetric.
+  struct point_stats
+  {
+    aabb bounds;
+    vec3 centroid;
+    f32 covariance[3][3];
+  };
+
+  // Computes all of point_stats in one pass over the points
+  inline point_stats statistics(const vec3 *v, size_t n)
+  {
+    detail::reduce3_result r = detail::reduce3(reinterpret_cast<const f32 *>(v), n, detail::dispatch().moments3);
+    f64 d = n ? (f64)n : 1.0;
+    f64 m[3] = {r.s[0] / d, r.s[1] / d, r.s[2] / d};
+    point_stats p = {aabb(vec3(r.lo[0], r.lo[1], r.lo[2]), vec3(r.hi[0], r.hi[1], r.hi[2])),
+                     vec3((f32)(r.k[0] + m[0]), (f32)(r.k[1] + m[1]), (f32)(r.k[2] + m[2])), {}};
+    for (int a = 0, j = 0; a < 3; a++)
+      for (int b = a; b < 3; b++, j++)
+        p.covariance[a][b] = p.covariance[b][a] = (f32)(r.s2[j] / d - m[a] * m[b]);
+    return p;
+  }
+
+  // Window rectangle and depth range as for glViewport and glDepthRange. NDC y = 1
+  // maps to y + height; for a top-left origin pass y = window height and a negative
+  // height.
+  struct viewport
+  {
+    f32 x, y, width, height;
+    f32 min_depth, max_depth;
+
+    viewport(f32 x, f32 y, f32 width, f32 height, f32 min_depth = 0.0F, f32 max_depth = 1.0F)
+        : x(x), y(y), width(width), height(height), min_depth(min_depth), max_depth(max_depth) {}
+  };
+
+  // Perspective divide and viewport mapping of n clip-space positions. The divide
+  // uses a refined reciprocal estimate (relative error around 1e-7) on SIMD paths.
+  // Positions with w <= 0 (behind the eye) come out as zero, and if behind is not
+  // null, bit i % 32 of behind[i / 32] is set for them and cleared otherwise;
+  // behind must hold (n + 31) / 32 words.
+  inline void project_to_screen(const vec4 *clip, vec3 *screen, size_t n, const viewport &vp, u32 *behind = nullptr)
+  {
+    const f32 t[6] = {
+        0.5F * vp.width, 0.5F * vp.height, 0.5F * (vp.max_depth - vp.min_depth),
+        vp.x + 0.5F * vp.width, vp.y + 0.5F * vp.height, 0.5F * (vp.max_depth + vp.min_depth)};
+    if (behind)
+      memset(behind, 0, (n + 31) / 32 * sizeof(u32));
+    detail::dispatch().project_to_screen(reinterpret_cast<const f32 *>(clip), reinterpret_cast<f32 *>(screen), behind, n, t);
+  }
+
+  // Structure-of-arrays containers with one stream per component. Indexing gives a
+  // vecN_ref whose .x/.y/.z/.w refer into the streams, so v[i].x += 1 works as for
+  // an array of vecN. Bulk operations require operands of the same size.
+
+  struct vec2_ref
+  {
+    f32 &x, &y;
+
+    operator vec2() const
     {
-      return &m00;
+      return vec2(x, y);
     }
 
-    mat4 &translate(const vec3 &xyz)
+    vec2_ref &operator=(const vec2 &v)
     {
-      mat4 t;
-      t.m30 = xyz.x;
-      t.m31 = xyz.y;
-      t.m32 = xyz.z;
-      return *this = *this * t;
+      x = v.x;
+      y = v.y;
+      return *this;
     }
 
-    mat4 translated(const vec3 &xyz) const
+    vec2_ref &operator=(const vec2_ref &v)
     {
-      mat4 r = *this;
-      return r.translate(xyz);
+      return *this = vec2(v);
     }
+  };
 
-    mat4 &scale(const vec3 &s)
+  struct vec2_soa
+  {
+    std::vector<f32> x, y;
+
+    explicit vec2_soa(size_t n = 0) : x(n), y(n) {}
+
+    size_t size() const
     {
-      mat4 t;
-      t.m00 = s.x;
-      t.m11 = s.y;
-      t.m22 = s.z;
-      return *this = *this * t;
+      return x.size();
     }
 
-    mat4 scaled(const vec3 &s) const
+    void resize(size_t n)
     {
-      mat4 r = *this;
-      return r.scale(s);
+      x.resize(n);
+      y.resize(n);
     }
 
-    mat4 &rotate(const vec3 &axis, f32 angle)
+    void push_back(const vec2 &v)
     {
-      mat4 t(quat(axis, angle));
-      return *this = *this * t;
+      x.push_back(v.x);
+      y.push_back(v.y);
     }
 
-    mat4 rotated(const vec3 &axis, f32 angle) const
+    vec2_ref operator[](size_t i)
     {
-      mat4 r = *this;
-      return r.rotate(axis, angle);
+      return vec2_ref{x[i], y[i]};
     }
 
-    mat4 &rotate(const quat &q)
+    vec2 operator[](size_t i) const
     {
-      return *this = *this * mat4(q);
+      return vec2(x[i], y[i]);
     }
 
-    mat4 rotated(const quat &q) const
+    vec2_soa &operator+=(const vec2_soa &b)
     {
-      mat4 r = *this;
-      return r.rotate(q);
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_add(x.data(), b.x.data(), x.data(), size());
+      detail::dispatch().soa_add(y.data(), b.y.data(), y.data(), size());
+      return *this;
     }
 
-    mat4 operator*(const mat4 &b) const
+    vec2_soa &operator-=(const vec2_soa &b)
     {
-      mat4 r;
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_sub(x.data(), b.x.data(), x.data(), size());
+      detail::dispatch().soa_sub(y.data(), b.y.data(), y.data(), size());
+      return *this;
+    }
 
-      r.m00 = m00 * b.m00 + m10 * b.m01 + m20 * b.m02 + m30 * b.m03;
-      r.m01 = m01 * b.m00 + m11 * b.m01 + m21 * b.m02 + m31 * b.m03;
-      r.m02 = m02 * b.m00 + m12 * b.m01 + m22 * b.m02 + m32 * b.m03;
-      r.m03 = m03 * b.m00 + m13 * b.m01 + m23 * b.m02 + m33 * b.m03;
+    vec2_soa &operator*=(f32 s)
+    {
+      detail::dispatch().soa_scale(x.data(), s, x.data(), size());
+      detail::dispatch().soa_scale(y.data(), s, y.data(), size());
+      return *this;
+    }
 
-      r.m10 = m00 * b.m10 + m10 * b.m11 + m20 * b.m12 + m30 * b.m13;
-      r.m11 = m01 * b.m10 + m11 * b.m11 + m21 * b.m12 + m31 * b.m13;
-      r.m12 = m02 * b.m10 + m12 * b.m11 + m22 * b.m12 + m32 * b.m13;
-      r.m13 = m03 * b.m10 + m13 * b.m11 + m23 * b.m12 + m33 * b.m13;
+    // *this += (b - *this) * t
+    vec2_soa &lerp(const vec2_soa &b, f32 t)
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_lerp(x.data(), b.x.data(), t, x.data(), size());
+      detail::dispatch().soa_lerp(y.data(), b.y.data(), t, y.data(), size());
+      return *this;
+    }
 
-      r.m20 = m00 * b.m20 + m10 * b.m21 + m20 * b.m22 + m30 * b.m23;
-      r.m21 = m01 * b.m20 + m11 * b.m21 + m21 * b.m22 + m31 * b.m23;
-      r.m22 = m02 * b.m20 + m12 * b.m21 + m22 * b.m22 + m32 * b.m23;
-      r.m23 = m03 * b.m20 + m13 * b.m21 + m23 * b.m22 + m33 * b.m23;
+    // out[i] = (*this)[i].dot(b[i]); out must hold size() floats
+    void dot(const vec2_soa &b, f32 *out) const
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      const f32 *a[4] = {x.data(), y.data(), nullptr, nullptr};
+      const f32 *c[4] = {b.x.data(), b.y.data(), nullptr, nullptr};
+      detail::dispatch().soa_dot(a, c, 2, out, size());
+    }
 
-      r.m30 = m00 * b.m30 + m10 * b.m31 + m20 * b.m32 + m30 * b.m33;
-      r.m31 = m01 * b.m30 + m11 * b.m31 + m21 * b.m32 + m31 * b.m33;
-      r.m32 = m02 * b.m30 + m12 * b.m31 + m22 * b.m32 + m32 * b.m33;
-      r.m33 = m03 * b.m30 + m13 * b.m31 + m23 * b.m32 + m33 * b.m33;
+    // out[i] = (*this)[i].length(); out must hold size() floats
+    void length(f32 *out) const
+    {
+      const f32 *a[4] = {x.data(), y.data(), nullptr, nullptr};
+      detail::dispatch().soa_length(a, 2, out, size());
+    }
 
-      return r;
+    vec2_soa &normalize()
+    {
+      f32 *a[4] = {x.data(), y.data(), nullptr, nullptr};
+      detail::dispatch().soa_normalize(a, 2, size());
+      return *this;
     }
+  };
 
-    vec4 operator*(const vec4 &b)
+  struct vec3_ref
+  {
+    f32 &x, &y, &z;
+
+    operator vec3() const
     {
-      return vec4(
-          m00 * b.x + m10 * b.y + m20 * b.z + m30 * b.w,
-          m01 * b.x + m11 * b.y + m21 * b.y + m31 * b.w,
-          m02 * b.x + m12 * b.y + m22 * b.z + m32 * b.w,
-          m03 * b.x + m13 * b.y + m23 * b.z + m33 * b.w);
+      return vec3(x, y, z);
     }
 
-    mat4 &operator*=(const mat4 &b)
+    vec3_ref &operator=(const vec3 &v)
     {
-      return *this = *this * b;
+      x = v.x;
+      y = v.y;
+      z = v.z;
+      return *this;
     }
 
-    static mat4 perspective(f32 fovy, f32 ar, f32 n, f32 f)
+    vec3_ref &operator=(const vec3_ref &v)
     {
-      mat4 result;
+      return *this = vec3(v);
+    }
+  };
 
-      f32 ht = tanf(fovy / 2.0F);
-      f32 t = n * ht;
-      f32 r = t * ar;
+  struct vec3_soa
+  {
+    std::vector<f32> x, y, z;
 
-      result.m00 = n / r;
-      result.m11 = n / t;
-      result.m22 = -(f + n) / (f - n);
-      result.m23 = -1.0F;
-      result.m32 = -(2.0F * n * f) / (f - n);
-      result.m33 = 0.0F;
+    explicit vec3_soa(size_t n = 0) : x(n), y(n), z(n) {}
 
-      return result;
+    size_t size() const
+    {
+      return x.size();
+    }
+
+    void resize(size_t n)
+    {
+      x.resize(n);
+      y.resize(n);
+      z.resize(n);
+    }
+
+    void push_back(const vec3 &v)
+    {
+      x.push_back(v.x);
+      y.push_back(v.y);
+      z.push_back(v.z);
+    }
+
+    vec3_ref operator[](size_t i)
+    {
+      return vec3_ref{x[i], y[i], z[i]};
+    }
+
+    vec3 operator[](size_t i) const
+    {
+      return vec3(x[i], y[i], z[i]);
+    }
+
+    vec3_soa &operator+=(const vec3_soa &b)
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_add(x.data(), b.x.data(), x.data(), size());
+      detail::dispatch().soa_add(y.data(), b.y.data(), y.data(), size());
+      detail::dispatch().soa_add(z.data(), b.z.data(), z.data(), size());
+      return *this;
+    }
+
+    vec3_soa &operator-=(const vec3_soa &b)
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_sub(x.data(), b.x.data(), x.data(), size());
+      detail::dispatch().soa_sub(y.data(), b.y.data(), y.data(), size());
+      detail::dispatch().soa_sub(z.data(), b.z.data(), z.data(), size());
+      return *this;
+    }
+
+    vec3_soa &operator*=(f32 s)
+    {
+      detail::dispatch().soa_scale(x.data(), s, x.data(), size());
+      detail::dispatch().soa_scale(y.data(), s, y.data(), size());
+      detail::dispatch().soa_scale(z.data(), s, z.data(), size());
+      return *this;
+    }
+
+    // *this += (b - *this) * t
+    vec3_soa &lerp(const vec3_soa &b, f32 t)
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_lerp(x.data(), b.x.data(), t, x.data(), size());
+      detail::dispatch().soa_lerp(y.data(), b.y.data(), t, y.data(), size());
+      detail::dispatch().soa_lerp(z.data(), b.z.data(), t, z.data(), size());
+      return *this;
+    }
+
+    // out[i] = (*this)[i].dot(b[i]); out must hold size() floats
+    void dot(const vec3_soa &b, f32 *out) const
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      const f32 *a[4] = {x.data(), y.data(), z.data(), nullptr};
+      const f32 *c[4] = {b.x.data(), b.y.data(), b.z.data(), nullptr};
+      detail::dispatch().soa_dot(a, c, 3, out, size());
+    }
+
+    // out[i] = (*this)[i].length(); out must hold size() floats
+    void length(f32 *out) const
+    {
+      const f32 *a[4] = {x.data(), y.data(), z.data(), nullptr};
+      detail::dispatch().soa_length(a, 3, out, size());
+    }
+
+    vec3_soa &normalize()
+    {
+      f32 *a[4] = {x.data(), y.data(), z.data(), nullptr};
+      detail::dispatch().soa_normalize(a, 3, size());
+      return *this;
+    }
+
+    // out[i] = (*this)[i].cross(b[i]); out may be *this or b
+    void cross(const vec3_soa &b, vec3_soa &out) const
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      out.resize(size());
+      const f32 *a[3] = {x.data(), y.data(), z.data()};
+      const f32 *c[3] = {b.x.data(), b.y.data(), b.z.data()};
+      f32 *r[3] = {out.x.data(), out.y.data(), out.z.data()};
+      detail::dispatch().soa_cross(a, c, r, size());
+    }
+  };
+
+  struct vec4_ref
+  {
+    f32 &x, &y, &z, &w;
+
+    operator vec4() const
+    {
+      return vec4(x, y, z, w);
+    }
+
+    vec4_ref &operator=(const vec4 &v)
+    {
+      x = v.x;
+      y = v.y;
+      z = v.z;
+      w = v.w;
+      return *this;
+    }
+
+    vec4_ref &operator=(const vec4_ref &v)
+    {
+      return *this = vec4(v);
+    }
+  };
+
+  struct vec4_soa
+  {
+    std::vector<f32> x, y, z, w;
+
+    explicit vec4_soa(size_t n = 0) : x(n), y(n), z(n), w(n) {}
+
+    size_t size() const
+    {
+      return x.size();
+    }
+
+    void resize(size_t n)
+    {
+      x.resize(n);
+      y.resize(n);
+      z.resize(n);
+      w.resize(n);
+    }
+
+    void push_back(const vec4 &v)
+    {
+      x.push_back(v.x);
+      y.push_back(v.y);
+      z.push_back(v.z);
+      w.push_back(v.w);
+    }
+
+    vec4_ref operator[](size_t i)
+    {
+      return vec4_ref{x[i], y[i], z[i], w[i]};
+    }
+
+    vec4 operator[](size_t i) const
+    {
+      return vec4(x[i], y[i], z[i], w[i]);
+    }
+
+    vec4_soa &operator+=(const vec4_soa &b)
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_add(x.data(), b.x.data(), x.data(), size());
+      detail::dispatch().soa_add(y.data(), b.y.data(), y.data(), size());
+      detail::dispatch().soa_add(z.data(), b.z.data(), z.data(), size());
+      detail::dispatch().soa_add(w.data(), b.w.data(), w.data(), size());
+      return *this;
+    }
+
+    vec4_soa &operator-=(const vec4_soa &b)
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_sub(x.data(), b.x.data(), x.data(), size());
+      detail::dispatch().soa_sub(y.data(), b.y.data(), y.data(), size());
+      detail::dispatch().soa_sub(z.data(), b.z.data(), z.data(), size());
+      detail::dispatch().soa_sub(w.data(), b.w.data(), w.data(), size());
+      return *this;
+    }
+
+    vec4_soa &operator*=(f32 s)
+    {
+      detail::dispatch().soa_scale(x.data(), s, x.data(), size());
+      detail::dispatch().soa_scale(y.data(), s, y.data(), size());
+      detail::dispatch().soa_scale(z.data(), s, z.data(), size());
+      detail::dispatch().soa_scale(w.data(), s, w.data(), size());
+      return *this;
+    }
+
+    // *this += (b - *this) * t
+    vec4_soa &lerp(const vec4_soa &b, f32 t)
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      detail::dispatch().soa_lerp(x.data(), b.x.data(), t, x.data(), size());
+      detail::dispatch().soa_lerp(y.data(), b.y.data(), t, y.data(), size());
+      detail::dispatch().soa_lerp(z.data(), b.z.data(), t, z.data(), size());
+      detail::dispatch().soa_lerp(w.data(), b.w.data(), t, w.data(), size());
+      return *this;
+    }
+
+    // out[i] = (*this)[i].dot(b[i]); out must hold size() floats
+    void dot(const vec4_soa &b, f32 *out) const
+    {
+      JW_MATH_ASSERT(b.size() == size());
+      const f32 *a[4] = {x.data(), y.data(), z.data(), w.data()};
+      const f32 *c[4] = {b.x.data(), b.y.data(), b.z.data(), b.w.data()};
+      detail::dispatch().soa_dot(a, c, 4, out, size());
+    }
+
+    // out[i] = (*this)[i].length(); out must hold size() floats
+    void length(f32 *out) const
+    {
+      const f32 *a[4] = {x.data(), y.data(), z.data(), w.data()};
+      detail::dispatch().soa_length(a, 4, out, size());
+    }
+
+    vec4_soa &normalize()
+    {
+      f32 *a[4] = {x.data(), y.data(), z.data(), w.data()};
+      detail::dispatch().soa_normalize(a, 4, size());
+      return *this;
     }
   };
 
+
+  // AoS <-> SoA conversion at memory bandwidth: a 4x4 transpose for vec4 and a
+  // three-way shuffle for the 12-byte vec3.
+
+  inline void aos_to_soa(const vec3 *in, f32 *x, f32 *y, f32 *z, size_t n, const execution_policy &policy = seq)
+  {
+    bool stream = policy.stream && detail::use_stream_stores(3 * n * sizeof(f32), x, y, z);
+    detail::parallel_for(n, 6 * sizeof(f32), policy, [&](size_t b, size_t e) {
+      f32 *soa[4] = {x + b, y + b, z + b, nullptr};
+      detail::dispatch().aos_to_soa3(reinterpret_cast<const f32 *>(in + b), soa, e - b, stream);
+    });
+  }
+
+  inline void aos_to_soa(const vec4 *in, f32 *x, f32 *y, f32 *z, f32 *w, size_t n, const execution_policy &policy = seq)
+  {
+    bool stream = policy.stream && detail::use_stream_stores(4 * n * sizeof(f32), x, y, z, w);
+    detail::parallel_for(n, 8 * sizeof(f32), policy, [&](size_t b, size_t e) {
+      f32 *soa[4] = {x + b, y + b, z + b, w + b};
+      detail::dispatch().aos_to_soa4(reinterpret_cast<const f32 *>(in + b), soa, e - b, stream);
+    });
+  }
+
+  inline void soa_to_aos(const f32 *x, const f32 *y, const f32 *z, vec3 *out, size_t n, const execution_policy &policy = seq)
+  {
+    bool stream = policy.stream && detail::use_stream_stores(n * sizeof(vec3), out);
+    detail::parallel_for(n, 6 * sizeof(f32), policy, [&](size_t b, size_t e) {
+      const f32 *soa[4] = {x + b, y + b, z + b, nullptr};
+      detail::dispatch().soa_to_aos3(soa, reinterpret_cast<f32 *>(out + b), e - b, stream);
+    });
+  }
+
+  inline void soa_to_aos(const f32 *x, const f32 *y, const f32 *z, const f32 *w, vec4 *out, size_t n, const execution_policy &policy = seq)
+  {
+    bool stream = policy.stream && detail::use_stream_stores(n * sizeof(vec4), out);
+    detail::parallel_for(n, 8 * sizeof(f32), policy, [&](size_t b, size_t e) {
+      const f32 *soa[4] = {x + b, y + b, z + b, w + b};
+      detail::dispatch().soa_to_aos4(soa, reinterpret_cast<f32 *>(out + b), e - b, stream);
+    });
+  }
+
+  inline void aos_to_soa(const vec3 *in, size_t n, vec3_soa &out, const execution_policy &policy = seq)
+  {
+    out.resize(n);
+    aos_to_soa(in, out.x.data(), out.y.data(), out.z.data(), n, policy);
+  }
+
+  inline void aos_to_soa(const vec4 *in, size_t n, vec4_soa &out, const execution_policy &policy = seq)
+  {
+    out.resize(n);
+    aos_to_soa(in, out.x.data(), out.y.data(), out.z.data(), out.w.data(), n, policy);
+  }
+
+  // out must hold in.size() elements
+  inline void soa_to_aos(const vec3_soa &in, vec3 *out, const execution_policy &policy = seq)
+  {
+    soa_to_aos(in.x.data(), in.y.data(), in.z.data(), out, in.size(), policy);
+  }
+
+  inline void soa_to_aos(const vec4_soa &in, vec4 *out, const execution_policy &policy = seq)
+  {
+    soa_to_aos(in.x.data(), in.y.data(), in.z.data(), in.w.data(), out, in.size(), policy);
+  }
+
+  // out[i] = mat4::from_trs(t[i], r[i], s[i]) with r holding quats; out must hold
+  // r.size() elements, and t and s must be as long as r
+  inline void from_trs(const vec3_soa &t, const vec4_soa &r, const vec3_soa &s, mat4 *out, const execution_policy &policy = seq)
+  {
+    JW_MATH_ASSERT(t.size() == r.size() && s.size() == r.size());
+    quat_to_mat4_soa(r.x.data(), r.y.data(), r.z.data(), r.w.data(), t.x.data(), t.y.data(), t.z.data(),
+                     s.x.data(), s.y.data(), s.z.data(), out, r.size(), policy);
+  }
+
+  inline void from_trs(const vec3_soa &t, const vec4_soa &r, const vec3_soa &s, affine3 *out, const execution_policy &policy = seq)
+  {
+    JW_MATH_ASSERT(t.size() == r.size() && s.size() == r.size());
+    quat_to_affine3_soa(r.x.data(), r.y.data(), r.z.data(), r.w.data(), t.x.data(), t.y.data(), t.z.data(),
+                        s.x.data(), s.y.data(), s.z.data(), out, r.size(), policy);
+  }
+
 }
 
 #endif